@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks WsClientAudio4a::set_allocation_free() against the in-process stand-in.
+ *
+ * The same scripted round trips (set_stream_state, its reply and the
+ * AHL_STREAM_STATE_EVENT it triggers) are run first on a bare afb-wsj1
+ * connection, then through the client with a typed event handler and a
+ * redundant call answered locally every fourth step. Allocations are counted
+ * on this thread only, the stand-in runs on its own. afb-wsj1 allocates for its
+ * framing in both runs, so the client passes when it adds nothing to that.
+ *
+ * usage: ahl4a-alloc-check [steps]
+ * exits 1 when the client allocates in steady state
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <systemd/sd-event.h>
+#include "alloc-counter.hpp"
+#include "ahl-interface.h"
+#include "ahl4a-json.hpp"
+#include "wsclient-audio4a.hpp"
+#include "mock-ahl4a.hpp"
+
+using namespace std;
+
+static const size_t Warmup = 200;
+
+struct RawRun {
+    size_t replies;
+    size_t events;
+};
+
+static void raw_on_hangup(void *closure, struct afb_wsj1 *wsj1) {
+}
+
+static void raw_on_call(void *closure, const char *api, const char *verb, struct afb_wsj1_msg *msg) {
+}
+
+static void raw_on_event(void *closure, const char *event, struct afb_wsj1_msg *msg) {
+    static_cast<RawRun*> (closure)->events++;
+}
+
+static void raw_on_reply(void *closure, struct afb_wsj1_msg *msg) {
+    static_cast<RawRun*> (closure)->replies++;
+}
+
+static const char* step_state(size_t i) {
+    return (i & 1) ? AHL_STREAM_STATE_RUNNING : AHL_STREAM_STATE_PAUSED;
+}
+
+/* allocations per step of the bare transport */
+static double raw_steps(sd_event* loop, int port, int stream_id, size_t steps) {
+    struct afb_wsj1_itf itf = {raw_on_hangup, raw_on_call, raw_on_event};
+    RawRun run{0, 0};
+    string uri = "ws://localhost:" + to_string(port) + "/api?token=check";
+    struct afb_wsj1* ws = afb_ws_client_connect_wsj1(loop, uri.c_str(), &itf, &run);
+    if (!ws) {
+        return -1;
+    }
+    string text;
+    uint64_t allocs = 0;
+    for (size_t i = 0; i < Warmup + steps; i++) {
+        if (i == Warmup) {
+            allocs = bench_thread_allocations();
+        }
+        text.clear();
+        ahl4a_json::stream_state(text, stream_id, step_state(i), (i & 2) != 0);
+        if (afb_wsj1_call_s(ws, "ahl4a", "set_stream_state", text.c_str(), raw_on_reply, &run) < 0) {
+            afb_wsj1_unref(ws);
+            return -1;
+        }
+        while (run.replies <= i || run.events <= i) {
+            sd_event_run(loop, (uint64_t)-1);
+        }
+    }
+    allocs = bench_thread_allocations() - allocs;
+    afb_wsj1_unref(ws);
+    return (double)allocs / (double)steps;
+}
+
+int main(int argc, char** argv) {
+    size_t steps = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000;
+    MockAhl4a::Config config;
+    MockAhl4a mock;
+    WsClientAudio4a client;
+    sd_event* loop;
+
+    if (steps == 0 || mock.start(0, config) < 0) {
+        fprintf(stderr, "mock start failed\n");
+        return 1;
+    }
+    sd_event_default(&loop);
+
+    client.set_allocation_free(true, 16, 4);
+    if (client.init(mock.port(), "check") < 0) {
+        fprintf(stderr, "client init failed\n");
+        return 1;
+    }
+    size_t events = 0;
+    size_t replies = 0;
+    size_t errors = 0;
+    client.set_stream_state_handler([&events](const StreamStateEvent&) { events++; });
+
+    int stream_id = -1;
+    client.stream_open(AHL_ROLE_ENTERTAINMENT, AUDIO4A_ENDPOINT_SINK, 0, [&stream_id](int status, struct json_object* reply) {
+        struct json_object *response, *jid;
+        if (status == WsClientAudio4a::Reply_Ok && json_object_object_get_ex(reply, "response", &response)
+            && json_object_object_get_ex(response, "stream_id", &jid))
+            stream_id = json_object_get_int(jid);
+        else
+            stream_id = 0;
+    });
+    while (stream_id < 0)
+        sd_event_run(loop, (uint64_t)-1);
+
+    double raw = raw_steps(loop, mock.port(), stream_id, steps);
+    if (raw < 0) {
+        fprintf(stderr, "raw connection failed\n");
+        return 1;
+    }
+
+    /* the same steps through the client, plus a redundant call answered locally */
+    struct Counters {
+        size_t* replies;
+        size_t* errors;
+    } counters{&replies, &errors};
+    const Counters* c = &counters;
+    const string states[2] = {AHL_STREAM_STATE_PAUSED, AHL_STREAM_STATE_RUNNING};
+    uint64_t allocs = 0;
+    for (size_t i = 0; i < Warmup + steps; i++) {
+        if (i == Warmup) {
+            allocs = bench_thread_allocations();
+        }
+        size_t expected = replies + 1;
+        size_t expected_events = events + 1;
+        WsClientAudio4a::RequestHandle h = client.set_stream_state(stream_id, states[i & 1], (i & 2) != 0,
+            [c](int status, struct json_object*) {
+                (*c->replies)++;
+                if (status != WsClientAudio4a::Reply_Ok) (*c->errors)++;
+            });
+        if (h == WsClientAudio4a::InvalidRequest) {
+            fprintf(stderr, "set_stream_state failed at step %zu\n", i);
+            return 1;
+        }
+        while (replies < expected || events < expected_events)
+            sd_event_run(loop, (uint64_t)-1);
+        if ((i & 3) == 3) {
+            client.set_stream_state(stream_id, states[i & 1], (i & 2) != 0, [c](int status, struct json_object*) {
+                if (status != WsClientAudio4a::Reply_Ok) (*c->errors)++;
+            });
+        }
+    }
+    double client_allocs = (double)(bench_thread_allocations() - allocs) / (double)steps;
+
+    printf("steps               %zu (after %zu warm-up steps), errors %zu\n", steps, Warmup, errors);
+    printf("afb-wsj1 alone      %8.3f allocs/step\n", raw);
+    printf("WsClientAudio4a     %8.3f allocs/step\n", client_allocs);
+    printf("added by the client %8.3f allocs/step\n", client_allocs - raw);
+
+    mock.stop();
+    sd_event_unref(loop);
+    if (errors || client_allocs > raw) {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
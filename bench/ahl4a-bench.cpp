@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drives WsClientAudio4a against the in-process ahl4a stand-in and reports
+ * call throughput, round-trip latency percentiles and event delivery rate.
+ *
+ * usage: ahl4a-bench [-n calls] [-w in_flight] [-d service_delay_us] [-e events_per_sec] [-t event_seconds] [-s]
+ *        -s dumps the client statistics (get_stats) as JSON
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <systemd/sd-event.h>
+#include "ahl-interface.h"
+#include "wsclient-audio4a.hpp"
+#include "mock-ahl4a.hpp"
+
+using namespace std;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+struct LatencyRun {
+    WsClientAudio4a* client;
+    int stream_id;
+    size_t total;
+    size_t sent;
+    size_t done;
+    size_t errors;
+    vector<uint64_t> latencies;
+};
+
+static void issue(LatencyRun* run) {
+    uint64_t start = now_ns();
+    bool running = (run->sent & 1) != 0;
+    run->sent++;
+    WsClientAudio4a::RequestHandle h = run->client->set_stream_state(run->stream_id,
+        running ? AHL_STREAM_STATE_RUNNING : AHL_STREAM_STATE_IDLE, false,
+        [run, start](int status, struct json_object*) {
+            run->latencies.push_back(now_ns() - start);
+            run->done++;
+            if (status != WsClientAudio4a::Reply_Ok)
+                run->errors++;
+            if (run->sent < run->total)
+                issue(run);
+        });
+    if (h == WsClientAudio4a::InvalidRequest) {
+        run->done++;
+        run->errors++;
+    }
+}
+
+static double percentile(const vector<uint64_t>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p * (double)(sorted.size() - 1));
+    return (double)sorted[i] / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    MockAhl4a::Config config;
+    MockAhl4a mock;
+    WsClientAudio4a client;
+    sd_event* loop;
+    size_t ncalls = 100000;
+    size_t window = 1;
+    double event_seconds = 2;
+    bool dump_stats = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:d:e:t:s")) != -1) {
+        switch (opt) {
+            case 'n': ncalls = strtoul(optarg, NULL, 10); break;
+            case 'w': window = max(1ul, strtoul(optarg, NULL, 10)); break;
+            case 'd': config.service_delay_us = strtoull(optarg, NULL, 10); break;
+            case 'e': config.event_rate = strtoull(optarg, NULL, 10); break;
+            case 't': event_seconds = atof(optarg); break;
+            case 's': dump_stats = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n calls] [-w in_flight] [-d service_delay_us] [-e events_per_sec] [-t event_seconds] [-s]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (mock.start(0, config) < 0) {
+        perror("mock start");
+        return 1;
+    }
+    /* the client attaches to the default loop of this thread */
+    sd_event_default(&loop);
+    if (client.init(mock.port(), "bench") < 0) {
+        fprintf(stderr, "client init failed\n");
+        return 1;
+    }
+
+    /* one stream to work on */
+    int stream_id = -1;
+    client.stream_open(AHL_ROLE_ENTERTAINMENT, AUDIO4A_ENDPOINT_SINK, 0, [&stream_id](int status, struct json_object* reply) {
+        struct json_object *response, *jid;
+        if (status == WsClientAudio4a::Reply_Ok && json_object_object_get_ex(reply, "response", &response)
+            && json_object_object_get_ex(response, "stream_id", &jid))
+            stream_id = json_object_get_int(jid);
+        else
+            stream_id = 0;
+    });
+    while (stream_id < 0)
+        sd_event_run(loop, (uint64_t)-1);
+
+    /* round trips, 'window' calls kept in flight */
+    LatencyRun run{&client, stream_id, ncalls, 0, 0, 0, vector<uint64_t>()};
+    run.latencies.reserve(ncalls);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < window && run.sent < run.total; i++)
+        issue(&run);
+    while (run.done < run.total)
+        sd_event_run(loop, (uint64_t)-1);
+    double elapsed = (double)(now_ns() - start) / 1e9;
+
+    sort(run.latencies.begin(), run.latencies.end());
+    printf("calls      %zu in %.3f s, %zu in flight, service delay %llu us\n",
+           run.done, elapsed, window, (unsigned long long)config.service_delay_us);
+    printf("calls/sec  %.0f (errors %zu)\n", (double)run.done / elapsed, run.errors);
+    printf("latency    p50 %.1f us  p99 %.1f us  p999 %.1f us  max %.1f us\n",
+           percentile(run.latencies, 0.50), percentile(run.latencies, 0.99),
+           percentile(run.latencies, 0.999), percentile(run.latencies, 1.0));
+
+    /* event delivery */
+    if (config.event_rate) {
+        uint64_t received = 0;
+        client.set_endpoint_volume_handler([&received](const EndpointVolumeEvent&) { received++; });
+        client.subscribe(AHL_ENDPOINT_VOLUME_EVENT);
+        uint64_t deadline = now_ns() + (uint64_t)(event_seconds * 1e9);
+        start = now_ns();
+        while (now_ns() < deadline)
+            sd_event_run(loop, 10000);
+        elapsed = (double)(now_ns() - start) / 1e9;
+        printf("events/sec %.0f delivered (%llu in %.3f s, %llu/s emitted)\n", (double)received / elapsed,
+               (unsigned long long)received, elapsed, (unsigned long long)config.event_rate);
+    }
+
+    if (dump_stats) {
+        unique_ptr<WsClientAudio4a::Stats> stats(new WsClientAudio4a::Stats);
+        client.get_stats(stats.get());
+        struct json_object* j_stats = stats->to_json();
+        printf("%s\n", json_object_to_json_string(j_stats));
+        json_object_put(j_stats);
+    }
+
+    mock.stop();
+    sd_event_unref(loop);
+    return 0;
+}
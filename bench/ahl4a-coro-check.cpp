@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the flow of the ahl4a-coro.hpp example against the in-process stand-in:
+ * stream_open, set_stream_state running, then the AHL_STREAM_STATE_EVENT of
+ * that stream through EventSource::next<StreamStateEvent>(). The only C++20
+ * target of the tree, the library it links stays C++17.
+ *
+ * usage: ahl4a-coro-check [rounds]
+ * exits 1 when a call fails or the state event does not come
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string_view>
+#include <systemd/sd-event.h>
+#include "ahl-interface.h"
+#include "wsclient-audio4a.hpp"
+#include "ahl4a-coro.hpp"
+#include "mock-ahl4a.hpp"
+
+#ifndef __cpp_impl_coroutine
+#error "ahl4a-coro-check needs C++20 coroutines"
+#endif
+
+using namespace std;
+
+static const uint64_t TimeoutUs = 5000000;
+
+struct Round {
+    int stream_id = -1;
+    bool opened = false;
+    bool running = false;       /* set_stream_state answered */
+    bool event = false;         /* AHL_STREAM_STATE_EVENT seen */
+    bool done = false;
+};
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* audio-4a pushes the state event before its reply, so the wait starts before the call */
+static ahl4a_coro::Task<> wait_running(ahl4a_coro::EventSource& events, Round* round) {
+    int id = round->stream_id;
+    StreamStateEvent ev = co_await events.next<StreamStateEvent>([id](const StreamStateEvent& e) {
+        return e.stream_id == id && e.state == string_view(AHL_STREAM_STATE_RUNNING);
+    });
+    round->event = (ev.stream_id == id);
+}
+
+static ahl4a_coro::Task<> flow(WsClientAudio4a& c, ahl4a_coro::EventSource& events, Round* round) {
+    ahl4a_coro::Result r = co_await ahl4a_coro::stream_open(c, AHL_ROLE_ENTERTAINMENT, AUDIO4A_ENDPOINT_SINK, 0);
+    round->stream_id = ahl4a_coro::stream_id(r);
+    round->opened = round->stream_id >= 0;
+    if (round->opened) {
+        ahl4a_coro::spawn(wait_running(events, round));
+        ahl4a_coro::Result s = co_await ahl4a_coro::set_stream_state(c, round->stream_id, AHL_STREAM_STATE_RUNNING, false);
+        round->running = s.ok();
+        co_await ahl4a_coro::stream_close(c, round->stream_id);
+    }
+    round->done = true;
+}
+
+int main(int argc, char** argv) {
+    size_t rounds = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100;
+    MockAhl4a::Config config;
+    MockAhl4a mock;
+    WsClientAudio4a client;
+    sd_event* loop;
+
+    if (rounds == 0 || mock.start(0, config) < 0) {
+        fprintf(stderr, "mock start failed\n");
+        return 1;
+    }
+    sd_event_default(&loop);
+    if (client.init(mock.port(), "check") < 0) {
+        fprintf(stderr, "client init failed\n");
+        return 1;
+    }
+
+    int ret = 0;
+    {
+        ahl4a_coro::EventSource events(client);
+        for (size_t i = 0; i < rounds && ret == 0; i++) {
+            Round round;
+            uint64_t deadline = now_us() + TimeoutUs;
+            ahl4a_coro::spawn(flow(client, events, &round));
+            while (!(round.done && round.event) && now_us() < deadline) {
+                sd_event_run(loop, 100000);
+            }
+            if (!round.opened || !round.running || !round.event) {
+                fprintf(stderr, "round %zu: opened %d, running %d, state event %d\n", i,
+                        round.opened, round.running, round.event);
+                ret = 1;
+            }
+        }
+    }
+    printf("%s: %zu rounds of open -> set running -> state event\n", ret ? "FAIL" : "ok", rounds);
+
+    mock.stop();
+    sd_event_unref(loop);
+    return ret;
+}
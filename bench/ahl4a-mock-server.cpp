@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Standalone ahl4a stand-in, for driving real applications without audio-4a.
+ *
+ * usage: ahl4a-mock-server [-p port | -u unix_path] [-d service_delay_us] [-e events_per_sec]
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include "mock-ahl4a.hpp"
+
+int main(int argc, char** argv) {
+    MockAhl4a::Config config;
+    MockAhl4a mock;
+    int port = 1234;
+    std::string path;
+    int opt;
+    sigset_t sigs;
+
+    while ((opt = getopt(argc, argv, "p:u:d:e:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'u': path = optarg; break;
+            case 'd': config.service_delay_us = strtoull(optarg, NULL, 10); break;
+            case 'e': config.event_rate = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-p port | -u unix_path] [-d service_delay_us] [-e events_per_sec]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    /* block before start so the server thread does not take the signals */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    if ((path.empty() ? mock.start(port, config) : mock.start_unix(path, config)) < 0) {
+        perror("ahl4a-mock-server");
+        return 1;
+    }
+    if (path.empty())
+        printf("ahl4a stand-in listening on ws://localhost:%d/api\n", mock.port());
+    else
+        printf("ahl4a stand-in listening on unix:%s\n", path.c_str());
+    fflush(stdout);
+
+    sigwait(&sigs, &opt);
+    mock.stop();
+    printf("served %llu calls, sent %llu events\n", (unsigned long long)mock.calls(), (unsigned long long)mock.events());
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Counts heap allocations of the whole process (C++ and C, json-c included)
+ * by interposing the glibc allocator, and those of the calling thread apart.
+ * Include in exactly one translation unit of a benchmark executable.
+ */
+
+#ifndef BENCH_ALLOC_COUNTER_H
+#define BENCH_ALLOC_COUNTER_H
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nmemb, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+static std::atomic<uint64_t> bench_nallocs(0);
+static thread_local uint64_t bench_thread_nallocs = 0;
+
+extern "C" void* malloc(size_t size) {
+    bench_nallocs.fetch_add(1, std::memory_order_relaxed);
+    bench_thread_nallocs++;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t nmemb, size_t size) {
+    bench_nallocs.fetch_add(1, std::memory_order_relaxed);
+    bench_thread_nallocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    bench_nallocs.fetch_add(1, std::memory_order_relaxed);
+    bench_thread_nallocs++;
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+static inline uint64_t bench_allocations() {
+    return bench_nallocs.load(std::memory_order_relaxed);
+}
+
+static inline uint64_t bench_thread_allocations() {
+    return bench_thread_nallocs;
+}
+
+#endif /* BENCH_ALLOC_COUNTER_H */
@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <signal.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <set>
+#include <string_view>
+#include "ahl-interface.h"
+#include "ahl4a-events.hpp"
+#include "mock-ahl4a.hpp"
+
+using namespace std;
+
+struct MockAhl4a::Connection {
+    int fd;
+    bool upgraded;
+    string in;
+    string out;
+    string fragments;
+    set<string> subscriptions;
+};
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/************* websocket handshake helpers *************/
+
+static void sha1(const unsigned char* data, size_t len, unsigned char digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    string msg((const char*)data, len);
+    uint64_t bits = (uint64_t)len * 8;
+    msg += (char)0x80;
+    while (msg.size() % 64 != 56)
+        msg += (char)0;
+    for (int i = 7; i >= 0; i--)
+        msg += (char)((bits >> (i * 8)) & 0xff);
+
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const unsigned char* p = (const unsigned char*)msg.data() + chunk + i * 4;
+            w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            uint32_t v = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (v << 1) | (v >> 31);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (unsigned char)(h[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(h[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(h[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)h[i];
+    }
+}
+
+static string base64(const unsigned char* data, size_t len) {
+    static const char tbl[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string out;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        out += tbl[(v >> 18) & 63];
+        out += tbl[(v >> 12) & 63];
+        out += (i + 1 < len) ? tbl[(v >> 6) & 63] : '=';
+        out += (i + 2 < len) ? tbl[v & 63] : '=';
+    }
+    return out;
+}
+
+/* value of an HTTP header, case insensitive name */
+static string header(const string& request, const char* name) {
+    size_t nlen = strlen(name);
+    size_t pos = 0;
+    while ((pos = request.find("\r\n", pos)) != string::npos) {
+        pos += 2;
+        if (strncasecmp(request.c_str() + pos, name, nlen) == 0 && request[pos + nlen] == ':') {
+            size_t start = request.find_first_not_of(' ', pos + nlen + 1);
+            size_t end = request.find("\r\n", start);
+            return request.substr(start, end - start);
+        }
+    }
+    return string();
+}
+
+/************* server *************/
+
+MockAhl4a::MockAhl4a()
+    : mlisten(-1), mwake(-1), mport(0), mnext_stream(1),
+      mevent_start_us(0), mevents_sent(0), mcalls(0), mevents(0) {
+}
+
+MockAhl4a::~MockAhl4a() {
+    stop();
+}
+
+int MockAhl4a::start(int port, const Config& config) {
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    int one = 1;
+
+    mconfig = config;
+    mlisten = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mlisten < 0)
+        return -1;
+    setsockopt(mlisten, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(mlisten, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(mlisten, 64) < 0
+        || getsockname(mlisten, (struct sockaddr*)&addr, &alen) < 0) {
+        close(mlisten);
+        mlisten = -1;
+        return -1;
+    }
+    mport = ntohs(addr.sin_port);
+    return launch();
+}
+
+int MockAhl4a::start_unix(const string& path, const Config& config) {
+    struct sockaddr_un addr;
+
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    mconfig = config;
+    mlisten = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mlisten < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.data(), path.size());
+    bool abstract = (path[0] == '@');
+    if (abstract)
+        addr.sun_path[0] = '\0';
+    else
+        unlink(path.c_str());
+    socklen_t alen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1));
+    if (bind(mlisten, (struct sockaddr*)&addr, alen) < 0 || listen(mlisten, 64) < 0) {
+        close(mlisten);
+        mlisten = -1;
+        return -1;
+    }
+    if (!abstract)
+        mpath = path;
+    return launch();
+}
+
+int MockAhl4a::launch() {
+    mwake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    mevent_start_us = now_us();
+    mthread = thread(&MockAhl4a::run, this);
+    return 0;
+}
+
+void MockAhl4a::stop() {
+    if (!mthread.joinable())
+        return;
+    uint64_t one = 1;
+    if (write(mwake, &one, sizeof(one)) < 0) {
+        /* thread will not wake up, nothing better to do */
+    }
+    mthread.join();
+    for (Connection* c : mconnections) {
+        close(c->fd);
+        delete c;
+    }
+    mconnections.clear();
+    mdelayed.clear();
+    close(mwake);
+    close(mlisten);
+    mwake = mlisten = -1;
+    if (!mpath.empty()) {
+        unlink(mpath.c_str());
+        mpath.clear();
+    }
+}
+
+void MockAhl4a::run() {
+    vector<struct pollfd> fds;
+    for (;;) {
+        uint64_t now = now_us();
+        flush_replies(now);
+        emit_events(now);
+
+        fds.clear();
+        fds.push_back({mwake, POLLIN, 0});
+        fds.push_back({mlisten, POLLIN, 0});
+        for (Connection* c : mconnections)
+            fds.push_back({c->fd, (short)(POLLIN | (c->out.empty() ? 0 : POLLOUT)), 0});
+
+        int64_t timeout = next_timeout(now);
+        struct timespec ts = {(time_t)(timeout / 1000000), (long)(timeout % 1000000) * 1000};
+        if (ppoll(fds.data(), fds.size(), timeout < 0 ? NULL : &ts, NULL) < 0 && errno != EINTR)
+            return;
+        if (fds[0].revents)
+            return;
+        if (fds[1].revents & POLLIN)
+            on_accept();
+
+        for (size_t i = 2; i < fds.size(); i++) {
+            Connection* c = connection(fds[i].fd);
+            bool alive = (c != nullptr);
+            if (alive && (fds[i].revents & POLLOUT))
+                alive = flush_out(*c);
+            if (alive && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                alive = on_readable(*c);
+            if (c && !alive) {
+                mconnections.erase(find(mconnections.begin(), mconnections.end(), c));
+                close(c->fd);
+                delete c;
+            }
+        }
+    }
+}
+
+void MockAhl4a::on_accept() {
+    int one = 1;
+    int fd = accept4(mlisten, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0)
+        return;
+    if (mport)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    mconnections.push_back(new Connection{fd, false, string(), string(), string(), set<string>()});
+}
+
+MockAhl4a::Connection* MockAhl4a::connection(int fd) {
+    for (Connection* c : mconnections)
+        if (c->fd == fd)
+            return c;
+    return nullptr;
+}
+
+bool MockAhl4a::on_readable(Connection& c) {
+    char buf[65536];
+    for (;;) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c.in.append(buf, (size_t)n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            break;
+        return false;
+    }
+    if (!c.upgraded && !handshake(c))
+        return false;
+    return c.upgraded ? frames(c) : true;
+}
+
+bool MockAhl4a::handshake(Connection& c) {
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    size_t end = c.in.find("\r\n\r\n");
+    if (end == string::npos)
+        return true;
+    string request = c.in.substr(0, end + 2);
+    c.in.erase(0, end + 4);
+
+    string key = header(request, "Sec-WebSocket-Key");
+    string protocol = header(request, "Sec-WebSocket-Protocol");
+    if (key.empty())
+        return false;
+    key += guid;
+    unsigned char digest[20];
+    sha1((const unsigned char*)key.data(), key.size(), digest);
+
+    string response = "HTTP/1.1 101 Switching Protocols\r\n"
+                      "Upgrade: websocket\r\n"
+                      "Connection: Upgrade\r\n"
+                      "Sec-WebSocket-Accept: " + base64(digest, sizeof(digest)) + "\r\n";
+    if (!protocol.empty())
+        response += "Sec-WebSocket-Protocol: x-afb-ws-json1\r\n";
+    response += "\r\n";
+    c.upgraded = true;
+    send_raw(c, response);
+    return true;
+}
+
+bool MockAhl4a::frames(Connection& c) {
+    for (;;) {
+        const unsigned char* p = (const unsigned char*)c.in.data();
+        size_t avail = c.in.size();
+        if (avail < 2)
+            return true;
+        bool fin = (p[0] & 0x80) != 0;
+        int opcode = p[0] & 0x0f;
+        bool masked = (p[1] & 0x80) != 0;
+        uint64_t len = p[1] & 0x7f;
+        size_t hdr = 2;
+        if (len == 126) {
+            if (avail < 4) return true;
+            len = ((uint64_t)p[2] << 8) | p[3];
+            hdr = 4;
+        } else if (len == 127) {
+            if (avail < 10) return true;
+            len = 0;
+            for (int i = 0; i < 8; i++)
+                len = (len << 8) | p[2 + i];
+            hdr = 10;
+        }
+        size_t mask_at = hdr;
+        if (masked)
+            hdr += 4;
+        if (avail < hdr + len)
+            return true;
+
+        string payload(c.in, hdr, (size_t)len);
+        if (masked)
+            for (size_t i = 0; i < payload.size(); i++)
+                payload[i] = (char)(payload[i] ^ p[mask_at + (i & 3)]);
+        c.in.erase(0, hdr + (size_t)len);
+
+        switch (opcode) {
+            case 0x0: /* continuation */
+            case 0x1: /* text */
+            case 0x2: /* binary */
+                c.fragments += payload;
+                if (fin) {
+                    string text;
+                    text.swap(c.fragments);
+                    on_message(c, text);
+                }
+                break;
+            case 0x8: /* close */
+                return false;
+            case 0x9: { /* ping */
+                string pong;
+                pong += (char)0x8a;
+                pong += (char)payload.size();
+                send_raw(c, pong + payload.substr(0, 125));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+/* [2,"id","api/verb",args(,"token")] */
+void MockAhl4a::on_message(Connection& c, const string& text) {
+    string_view code, id, method, args;
+    int icode;
+    if (!ahl4a_scan::element(text, 0, &code) || !ahl4a_scan::as_int(code, &icode) || icode != 2)
+        return;
+    if (!ahl4a_scan::element(text, 1, &id) || !ahl4a_scan::element(text, 2, &method)
+        || !ahl4a_scan::element(text, 3, &args))
+        return;
+    string_view smethod;
+    if (!ahl4a_scan::as_string(method, &smethod))
+        return;
+    size_t slash = smethod.find('/');
+    string verb(smethod.substr(slash == string_view::npos ? 0 : slash + 1));
+
+    mcalls.fetch_add(1, memory_order_relaxed);
+    bool ok = true;
+    string response = handle_call(c, verb, string(args), &ok);
+    string reply = "[" + string(ok ? "3" : "4") + "," + string(id) + ","
+        + "{\"response\":" + response + ",\"jtype\":\"afb-reply\",\"request\":{\"status\":\""
+        + (ok ? "success" : "failed") + "\"}}]";
+
+    if (mconfig.service_delay_us == 0) {
+        send_text(c, reply);
+    } else {
+        mdelayed.push_back(DelayedReply{now_us() + mconfig.service_delay_us, c.fd, reply});
+    }
+}
+
+static int arg_int(const string& args, const char* key, int dflt) {
+    string_view v;
+    int i = dflt;
+    if (ahl4a_scan::member(args, key, &v))
+        ahl4a_scan::as_int(v, &i);
+    return i;
+}
+
+static string arg_raw(const string& args, const char* key, const char* dflt) {
+    string_view v;
+    return ahl4a_scan::member(args, key, &v) ? string(v) : string(dflt);
+}
+
+string MockAhl4a::handle_call(Connection& c, const string& verb, const string& args, bool* ok) {
+    if (verb == "stream_open") {
+        int stream = mnext_stream++;
+        return "{\"stream_id\":" + to_string(stream) + ",\"endpoint_info\":{\"endpoint_id\":"
+            + to_string(max(0, arg_int(args, "endpoint_id", 0))) + ",\"endpoint_type\":"
+            + arg_raw(args, "endpoint_type", "\"sink\"") + "}}";
+    }
+    if (verb == "stream_close") {
+        return "null";
+    }
+    if (verb == "set_stream_state") {
+        if (mconfig.stream_state_events) {
+            send_event(c, AHL_STREAM_STATE_EVENT, "{\"stream_id\":" + to_string(arg_int(args, "stream_id", -1))
+                + ",\"state\":" + arg_raw(args, "state", "\"idle\"")
+                + ",\"mute\":" + arg_raw(args, "mute", "false") + "}");
+        }
+        return "null";
+    }
+    if (verb == "get_endpoints") {
+        string type = arg_raw(args, "endpoint_type", "\"sink\"");
+        return "[{\"endpoint_id\":0,\"endpoint_type\":" + type + ",\"device_name\":\"mock0\"},"
+               "{\"endpoint_id\":1,\"endpoint_type\":" + type + ",\"device_name\":\"mock1\"}]";
+    }
+    if (verb == "get_endpoint_info") {
+        return "{\"endpoint_id\":" + to_string(arg_int(args, "endpoint_id", 0)) + ",\"endpoint_type\":"
+            + arg_raw(args, "endpoint_type", "\"sink\"") + ",\"device_name\":\"mock\",\"volume\":50}";
+    }
+    if (verb == "get_stream_info") {
+        return "{\"stream_id\":" + to_string(arg_int(args, "stream_id", -1))
+            + ",\"state\":\"idle\",\"mute\":\"off\",\"endpoint_info\":{\"endpoint_id\":0}}";
+    }
+    if (verb == "volume") {
+        return "{\"volume\":" + arg_raw(args, "volume", "50") + "}";
+    }
+    if (verb == "property") {
+        return "{\"value\":" + arg_raw(args, "value", "0") + "}";
+    }
+    if (verb == "event_subscription") {
+        string_view events, name;
+        int subscribe;
+        string_view v;
+        /* the binding reads "subscribe" with wrap_json's 'i', true/false is refused there */
+        if (!ahl4a_scan::member(args, "subscribe", &v) || !ahl4a_scan::as_int(v, &subscribe)) {
+            *ok = false;
+            return "\"subscribe should be 1 or 0\"";
+        }
+        if (ahl4a_scan::member(args, "events", &events)) {
+            for (size_t i = 0; ahl4a_scan::element(events, i, &v); i++) {
+                if (!ahl4a_scan::as_string(v, &name))
+                    continue;
+                if (subscribe)
+                    c.subscriptions.insert(string(name));
+                else
+                    c.subscriptions.erase(string(name));
+            }
+        }
+        return "null";
+    }
+    *ok = false;
+    return "\"unknown verb\"";
+}
+
+void MockAhl4a::send_raw(Connection& c, const string& data) {
+    c.out += data;
+    flush_out(c);
+}
+
+bool MockAhl4a::flush_out(Connection& c) {
+    while (!c.out.empty()) {
+        ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EINTR;
+        c.out.erase(0, (size_t)n);
+    }
+    return true;
+}
+
+void MockAhl4a::send_text(Connection& c, const string& text) {
+    string frame;
+    frame += (char)0x81;
+    if (text.size() < 126) {
+        frame += (char)text.size();
+    } else if (text.size() < 65536) {
+        frame += (char)126;
+        frame += (char)(text.size() >> 8);
+        frame += (char)(text.size() & 0xff);
+    } else {
+        frame += (char)127;
+        for (int i = 7; i >= 0; i--)
+            frame += (char)(((uint64_t)text.size() >> (i * 8)) & 0xff);
+    }
+    send_raw(c, frame + text);
+}
+
+void MockAhl4a::send_event(Connection& c, const char* event, const string& data) {
+    string name = string("ahl4a/") + event;
+    mevents.fetch_add(1, memory_order_relaxed);
+    send_text(c, "[5,\"" + name + "\",{\"event\":\"" + name + "\",\"data\":" + data + ",\"jtype\":\"afb-event\"}]");
+}
+
+void MockAhl4a::emit_events(uint64_t now) {
+    if (mconfig.event_rate == 0)
+        return;
+    uint64_t due = (now - mevent_start_us) * mconfig.event_rate / 1000000;
+    for (; mevents_sent < due; mevents_sent++) {
+        for (Connection* c : mconnections) {
+            if (c->upgraded && c->subscriptions.count(AHL_ENDPOINT_VOLUME_EVENT)) {
+                send_event(*c, AHL_ENDPOINT_VOLUME_EVENT,
+                    "{\"endpoint_id\":0,\"endpoint_type\":\"sink\",\"audio_role\":\"entertainment\",\"value\":"
+                    + to_string(mevents_sent % 101) + "}");
+            }
+        }
+    }
+}
+
+void MockAhl4a::flush_replies(uint64_t now) {
+    while (!mdelayed.empty() && mdelayed.front().due_us <= now) {
+        Connection* c = connection(mdelayed.front().fd);
+        if (c)
+            send_text(*c, mdelayed.front().text);
+        mdelayed.pop_front();
+    }
+}
+
+/* microseconds until the next delayed reply or event, -1 when nothing is due */
+int64_t MockAhl4a::next_timeout(uint64_t now) const {
+    int64_t timeout = -1;
+    if (!mdelayed.empty())
+        timeout = (mdelayed.front().due_us <= now) ? 0 : (int64_t)(mdelayed.front().due_us - now);
+    if (mconfig.event_rate != 0) {
+        uint64_t due = mevent_start_us + (mevents_sent + 1) * 1000000 / mconfig.event_rate;
+        int64_t t = (due <= now) ? 0 : (int64_t)(due - now);
+        timeout = (timeout < 0) ? t : min(timeout, t);
+    }
+    return timeout;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MOCK_AHL4A_H
+#define MOCK_AHL4A_H
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Local stand-in for the audio-4a "ahl4a" API.
+ *
+ * Speaks the afb-daemon websocket protocol (x-afb-ws-json1) on 127.0.0.1 or on
+ * a unix socket from its own thread, so a WsClientAudio4a can init() against it
+ * with any token.
+ * Implements stream_open, stream_close, set_stream_state, get_endpoints,
+ * get_endpoint_info, get_stream_info, volume, property and event_subscription.
+ */
+class MockAhl4a
+{
+public:
+    struct Config {
+        uint64_t service_delay_us = 0;      /* delay before each reply */
+        uint64_t event_rate = 0;            /* AHL_ENDPOINT_VOLUME_EVENT per second to subscribers */
+        bool stream_state_events = true;    /* AHL_STREAM_STATE_EVENT on set_stream_state */
+    };
+
+    MockAhl4a();
+    ~MockAhl4a();
+    MockAhl4a(const MockAhl4a &) = delete;
+    MockAhl4a &operator=(const MockAhl4a &) = delete;
+
+    /* port 0 picks a free one, see port() */
+    int start(int port, const Config& config);
+    /* AF_UNIX listener, "@name" for the abstract namespace, a path is removed at stop() */
+    int start_unix(const std::string& path, const Config& config);
+    void stop();
+    int port() const { return mport; }
+
+    uint64_t calls() const { return mcalls.load(std::memory_order_relaxed); }
+    uint64_t events() const { return mevents.load(std::memory_order_relaxed); }
+
+private:
+    struct Connection;
+    struct DelayedReply {
+        uint64_t due_us;
+        int fd;
+        std::string text;
+    };
+
+    int launch();
+    void run();
+    void on_accept();
+    bool on_readable(Connection& c);
+    bool handshake(Connection& c);
+    bool frames(Connection& c);
+    void on_message(Connection& c, const std::string& text);
+    std::string handle_call(Connection& c, const std::string& verb, const std::string& args, bool* ok);
+    void send_text(Connection& c, const std::string& text);
+    void send_raw(Connection& c, const std::string& data);
+    bool flush_out(Connection& c);
+    Connection* connection(int fd);
+    void send_event(Connection& c, const char* event, const std::string& data);
+    void emit_events(uint64_t now_us);
+    void flush_replies(uint64_t now_us);
+    int64_t next_timeout(uint64_t now_us) const;
+
+    Config mconfig;
+    int mlisten;
+    int mwake;
+    int mport;
+    std::string mpath;
+    std::thread mthread;
+    std::vector<Connection*> mconnections;
+    std::deque<DelayedReply> mdelayed;
+    int mnext_stream;
+    uint64_t mevent_start_us;
+    uint64_t mevents_sent;
+    std::atomic<uint64_t> mcalls;
+    std::atomic<uint64_t> mevents;
+};
+
+#endif /* MOCK_AHL4A_H */
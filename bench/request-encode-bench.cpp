@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Request encoding cost: former wrap_json_pack + json-c tree + serialization
+ * (what afb_wsj1_call_j did with it) against the ahl4a_json serializers
+ * writing into a reused buffer (what afb_wsj1_call_s now gets).
+ *
+ * usage: request-encode-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <json-c/json.h>
+#include "wrap-json.h"
+#include "alloc-counter.hpp"
+#include "ahl4a-json.hpp"
+
+using namespace std;
+
+static size_t sink_bytes = 0;
+
+/* the text is consumed as afb-wsj1 would, by length */
+static void consume(const char* text) {
+    sink_bytes += strlen(text);
+}
+
+template <typename Fn>
+static void run(const char* label, size_t iterations, Fn fn) {
+    uint64_t allocs = bench_allocations();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        fn((int)(i & 0xff));
+    }
+    auto stop = chrono::steady_clock::now();
+    allocs = bench_allocations() - allocs;
+    double ns = (double)chrono::duration_cast<chrono::nanoseconds>(stop - start).count();
+    printf("%-30s %8.2f ns/call %8.3f allocs/call\n",
+           label, ns / (double)iterations, (double)allocs / (double)iterations);
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+    string buf;
+    const string role("Multimedia");
+    const string state("running");
+    const string event("ahl_stream_state_event");
+
+    run("stream_open wrap_json_pack", iterations, [&](int id) {
+        json_object* j_obj;
+        if (wrap_json_pack(&j_obj, "{s:s,s:s,s:i}", "audio_role", role.c_str(), "endpoint_type", "sink", "endpoint_id", id) == 0) {
+            consume(json_object_to_json_string(j_obj));
+            json_object_put(j_obj);
+        }
+    });
+    run("stream_open ahl4a_json", iterations, [&](int id) {
+        buf.clear();
+        ahl4a_json::stream_open(buf, role, "sink", id);
+        consume(buf.c_str());
+    });
+
+    run("stream_close wrap_json_pack", iterations, [&](int id) {
+        json_object* j_obj;
+        if (wrap_json_pack(&j_obj, "{s:i}", "stream_id", id) == 0) {
+            consume(json_object_to_json_string(j_obj));
+            json_object_put(j_obj);
+        }
+    });
+    run("stream_close ahl4a_json", iterations, [&](int id) {
+        buf.clear();
+        ahl4a_json::stream_close(buf, id);
+        consume(buf.c_str());
+    });
+
+    run("set_stream_state wrap_json_pack", iterations, [&](int id) {
+        json_object* j_obj;
+        if (wrap_json_pack(&j_obj, "{s:i,s:s,s:b}", "stream_id", id, "state", state.c_str(), "mute", id & 1) == 0) {
+            consume(json_object_to_json_string(j_obj));
+            json_object_put(j_obj);
+        }
+    });
+    run("set_stream_state ahl4a_json", iterations, [&](int id) {
+        buf.clear();
+        ahl4a_json::stream_state(buf, id, state, (id & 1) != 0);
+        consume(buf.c_str());
+    });
+
+    run("subscribe wrap_json_pack", iterations, [&](int) {
+        json_object* j_obj;
+        if (wrap_json_pack(&j_obj, "{s:[s],s:i}", "events", event.c_str(), "subscribe", 1) == 0) {
+            consume(json_object_to_json_string(j_obj));
+            json_object_put(j_obj);
+        }
+    });
+    run("subscribe ahl4a_json", iterations, [&](int) {
+        string_view events[1] = {event};
+        buf.clear();
+        ahl4a_json::subscription(buf, events, true);
+        consume(buf.c_str());
+    });
+
+    printf("(%zu bytes encoded)\n", sink_bytes);
+    return 0;
+}
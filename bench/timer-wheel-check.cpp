@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks TimerWheel against a brute-force model with random add(), remove()
+ * and advance(). Deadlines go up to three times Range so the overflow list is
+ * used. After each step next_due() has to be the earliest armed deadline, and
+ * every timer has to expire in the advance() that passes its deadline, never
+ * before. Half of the advances jump to next_due() as the client loop does.
+ *
+ * usage: timer-wheel-check [steps] [seed]
+ * exits 1 on the first mismatch
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include "ahl4a-timer-wheel.hpp"
+
+using namespace std;
+
+struct Node {
+    Node* timer_prev = nullptr;
+    Node* timer_next = nullptr;
+    uint64_t timer_due = 0;
+    int timer_slot = -1;
+    uint64_t want = 0;          /* model: deadline, when armed */
+    bool armed = false;
+};
+
+typedef TimerWheel<Node> Wheel;
+
+static uint64_t model_next(const vector<Node>& nodes) {
+    uint64_t next = Wheel::Never;
+    for (const Node& n : nodes) {
+        if (n.armed && n.want < next) next = n.want;
+    }
+    return next;
+}
+
+int main(int argc, char** argv) {
+    size_t steps = (argc > 1) ? strtoul(argv[1], NULL, 10) : 300000;
+    uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 10) : 11;
+    mt19937_64 rng(seed);
+    Wheel wheel;
+    vector<Node> nodes(3000);
+    uint64_t now = 987654321;
+    size_t fired = 0;
+
+    for (size_t step = 0; step < steps; step++) {
+        unsigned op = (unsigned)(rng() % 10);
+        Node& n = nodes[rng() % nodes.size()];
+        if (op < 4) {
+            uint64_t delay;
+            switch (rng() % 6) {
+                case 0: delay = rng() % (3 * Wheel::Range); break;
+                case 1: delay = rng() % Wheel::Range; break;
+                case 2: delay = rng() % 300000; break;
+                default: delay = rng() % 3000; break;
+            }
+            if (delay == 0) delay = 1;
+            wheel.add(&n, now + delay, now);
+            n.want = now + delay;
+            n.armed = true;
+            continue;
+        }
+        if (op < 5) {
+            wheel.remove(&n);
+            n.armed = false;
+            continue;
+        }
+
+        uint64_t expected = model_next(nodes);
+        if (wheel.next_due() != expected) {
+            fprintf(stderr, "step %zu: next_due %llu, earliest deadline %llu\n", step,
+                    (unsigned long long)wheel.next_due(), (unsigned long long)expected);
+            return 1;
+        }
+        if (op < 8 || expected == Wheel::Never) {
+            now += (rng() % 50 == 0) ? rng() % (2 * Wheel::Range) : rng() % 100;
+        } else {
+            now = expected;
+        }
+        bool early = false;
+        wheel.advance(now, [&](Node* t) {
+            fired++;
+            early |= !t->armed || t->want > now;
+            t->armed = false;
+        });
+        if (early) {
+            fprintf(stderr, "step %zu: a timer expired before its deadline\n", step);
+            return 1;
+        }
+        for (const Node& t : nodes) {
+            if (t.armed && t.want <= now) {
+                fprintf(stderr, "step %zu: a timer due at %llu is still armed at %llu\n", step,
+                        (unsigned long long)t.want, (unsigned long long)now);
+                return 1;
+            }
+        }
+    }
+
+    size_t armed = 0;
+    for (const Node& n : nodes) armed += n.armed;
+    if (armed != wheel.size()) {
+        fprintf(stderr, "%zu timers armed, the wheel holds %zu\n", armed, wheel.size());
+        return 1;
+    }
+    printf("ok: %zu steps, %zu expired, %zu still armed\n", steps, fired, armed);
+    return 0;
+}
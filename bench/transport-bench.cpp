@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Round trips over loopback TCP against the same over an AF_UNIX socket, both
+ * against the in-process ahl4a stand-in. Reports latency percentiles and CPU
+ * per call, of the client thread and of the whole process (client + stand-in).
+ *
+ * usage: transport-bench [-n calls] [-d service_delay_us]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <systemd/sd-event.h>
+#include "ahl-interface.h"
+#include "wsclient-audio4a.hpp"
+#include "mock-ahl4a.hpp"
+
+using namespace std;
+
+static uint64_t clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static double percentile(const vector<uint64_t>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p * (double)(sorted.size() - 1));
+    return (double)sorted[i] / 1000.0;
+}
+
+/* one set_stream_state at a time, the state flips so none is answered locally */
+static size_t ping_pong(WsClientAudio4a* client, sd_event* loop, int stream_id, size_t n, vector<uint64_t>* latencies) {
+    size_t errors = 0;
+    for (size_t i = 0; i < n; i++) {
+        bool done = false;
+        uint64_t start = clock_ns(CLOCK_MONOTONIC);
+        WsClientAudio4a::RequestHandle h = client->set_stream_state(stream_id,
+            (i & 1) ? AHL_STREAM_STATE_RUNNING : AHL_STREAM_STATE_IDLE, false,
+            [&done, &errors](int status, struct json_object*) {
+                done = true;
+                if (status != WsClientAudio4a::Reply_Ok)
+                    errors++;
+            });
+        if (h == WsClientAudio4a::InvalidRequest)
+            return n;
+        while (!done)
+            sd_event_run(loop, (uint64_t)-1);
+        if (latencies)
+            latencies->push_back(clock_ns(CLOCK_MONOTONIC) - start);
+    }
+    return errors;
+}
+
+static int run(const char* name, bool use_unix, size_t ncalls, const MockAhl4a::Config& config, sd_event* loop) {
+    MockAhl4a mock;
+    unique_ptr<WsClientAudio4a> client(new WsClientAudio4a);
+    string path = "@ahl4a-transport-bench-" + to_string(getpid());
+
+    if ((use_unix ? mock.start_unix(path, config) : mock.start(0, config)) < 0) {
+        perror("mock start");
+        return -1;
+    }
+    int ret = use_unix ? client->init("unix:" + path + "?token=bench") : client->init(mock.port(), "bench");
+    if (ret < 0) {
+        fprintf(stderr, "%s: client init failed\n", name);
+        return -1;
+    }
+
+    int stream_id = -1;
+    client->stream_open(AHL_ROLE_ENTERTAINMENT, AUDIO4A_ENDPOINT_SINK, 0, [&stream_id](int status, struct json_object* reply) {
+        struct json_object *response, *jid;
+        if (status == WsClientAudio4a::Reply_Ok && json_object_object_get_ex(reply, "response", &response)
+            && json_object_object_get_ex(response, "stream_id", &jid))
+            stream_id = json_object_get_int(jid);
+        else
+            stream_id = 0;
+    });
+    while (stream_id < 0)
+        sd_event_run(loop, (uint64_t)-1);
+
+    /* warm caches, buffers and the stand-in up first */
+    ping_pong(client.get(), loop, stream_id, min(ncalls / 10 + 1, (size_t)1000), nullptr);
+
+    vector<uint64_t> latencies;
+    latencies.reserve(ncalls);
+    uint64_t wall = clock_ns(CLOCK_MONOTONIC);
+    uint64_t thread_cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t process_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    size_t errors = ping_pong(client.get(), loop, stream_id, ncalls, &latencies);
+    process_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - process_cpu;
+    thread_cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - thread_cpu;
+    wall = clock_ns(CLOCK_MONOTONIC) - wall;
+
+    sort(latencies.begin(), latencies.end());
+    printf("%-5s %8zu %10.0f %8.1f %8.1f %8.1f %14.2f %14.2f %7zu\n", name, ncalls,
+           (double)ncalls / ((double)wall / 1e9),
+           percentile(latencies, 0.50), percentile(latencies, 0.99), percentile(latencies, 0.999),
+           (double)thread_cpu / 1000.0 / (double)ncalls, (double)process_cpu / 1000.0 / (double)ncalls, errors);
+
+    client.reset();
+    mock.stop();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    MockAhl4a::Config config;
+    sd_event* loop;
+    size_t ncalls = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        switch (opt) {
+            case 'n': ncalls = max(1ul, strtoul(optarg, NULL, 10)); break;
+            case 'd': config.service_delay_us = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n calls] [-d service_delay_us]\n", argv[0]);
+                return 1;
+        }
+    }
+    config.stream_state_events = false;
+
+    /* the clients attach to the default loop of this thread */
+    sd_event_default(&loop);
+    printf("%-5s %8s %10s %8s %8s %8s %14s %14s %7s\n", "", "calls", "calls/sec", "p50 us", "p99 us", "p999 us",
+           "client cpu us", "total cpu us", "errors");
+    int ret = 0;
+    if (run("tcp", false, ncalls, config, loop) < 0 || run("unix", true, ncalls, config, loop) < 0)
+        ret = 1;
+    sd_event_unref(loop);
+    return ret;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Verb validation cost: former api_list scan (std::find over std::vector<std::string>
+ * with a temporary std::string per call) against audio4a_verb_lookup().
+ *
+ * usage: verb-lookup-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "alloc-counter.hpp"
+#include "ahl4a-verbs.hpp"
+
+using namespace std;
+
+static const vector<string> api_list{
+    string("stream_open"),
+    string("stream_close"),
+    string("get_endpoints"),
+    string("set_stream_state"),
+    string("get_stream_info"),
+    string("volume"),
+    string("get_endpoint_info"),
+    string("property"),
+    string("event_subscription"),
+    };
+
+/* mix of hits (late and early in the table) and misses */
+static const char* samples[] = {
+    "set_stream_state", "event_subscription", "stream_open", "volume",
+    "get_endpoint_info", "registerSource", "property", "connect",
+};
+static const size_t nsamples = sizeof(samples) / sizeof(samples[0]);
+
+static bool has_verb(const string& verb) {
+    return find(api_list.begin(), api_list.end(), verb) != api_list.end();
+}
+
+template <typename Fn>
+static void run(const char* label, size_t iterations, Fn fn) {
+    size_t hits = 0;
+    uint64_t allocs = bench_allocations();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        hits += fn(samples[i % nsamples]) ? 1 : 0;
+    }
+    auto stop = chrono::steady_clock::now();
+    allocs = bench_allocations() - allocs;
+    double ns = (double)chrono::duration_cast<chrono::nanoseconds>(stop - start).count();
+    printf("%-22s %8.2f ns/lookup %8.3f allocs/lookup (hits %zu)\n",
+           label, ns / (double)iterations, (double)allocs / (double)iterations, hits);
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000000;
+
+    run("api_list std::find", iterations, [](const char* verb) {
+        return has_verb(string(verb));
+    });
+    run("audio4a_verb_lookup", iterations, [](const char* verb) {
+        return audio4a_verb_lookup(verb) != AUDIO4A_VERB_UNKNOWN;
+    });
+    return 0;
+}
@@ -60,7 +60,8 @@ set(PROJECT_APP_TEMPLATES_DIR "conf.d/app-templates")
 
 # Compiler selection if needed. Impose a minimal version.
 # -----------------------------------------------
-set (gcc_minimal_version 4.9)
+# 11.0: std::to_chars and std::from_chars for double (ahl4a-json.hpp, ahl4a-events.cpp)
+set (gcc_minimal_version 11.0)
 
 # PKG_CONFIG required packages
 # -----------------------------
@@ -86,7 +87,7 @@ set (PKG_REQUIRED_LIST
 # Either separate options with ";", or each options must be quoted separately
 # DO NOT PUT ALL OPTION QUOTED AT ONCE , COMPILATION COULD FAILED !
 # ----------------------------------------------------------------------------
-list(APPEND CMAKE_CXX_FLAGS "-std=c++11")
+list(APPEND CMAKE_CXX_FLAGS "-std=c++17")
 
 set(COMPILE_OPTIONS
 -Wl,--as-needed -Wl,--gc-sections -Wl,--no-undefined
@@ -126,6 +127,10 @@ set(COMPILE_OPTIONS
 # -O2
 # CACHE STRING "Compilation flags for RELEASE build type.")
 
+# Benchmarks (bench/) are not part of the default build
+# -------------------------------------------------------
+option(BUILD_BENCHMARKS "Build wsclient-audio4a benchmarks" OFF)
+
 # (BUG!!!) as PKG_CONFIG_PATH does not work [should be an env variable]
 # ---------------------------------------------------------------------
 set(CMAKE_PREFIX_PATH ${CMAKE_INSTALL_PREFIX}/lib64/pkgconfig ${CMAKE_INSTALL_PREFIX}/lib/pkgconfig)
@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_CORO_H
+#define AHL4A_CORO_H
+
+/*
+ * C++20 coroutines over WsClientAudio4a, header only. Empty before C++20, the
+ * library itself stays C++17.
+ *
+ *   ahl4a_coro::Task<> wait_state(ahl4a_coro::EventSource& events, int id) {
+ *       StreamStateEvent ev = co_await events.next<StreamStateEvent>(
+ *           [id](const StreamStateEvent& e) { return e.stream_id == id; });
+ *   }
+ *   ahl4a_coro::Task<> flow(WsClientAudio4a& c, ahl4a_coro::EventSource& events) {
+ *       ahl4a_coro::Result r = co_await ahl4a_coro::stream_open(c, AHL_ROLE_ENTERTAINMENT, AUDIO4A_ENDPOINT_SINK, 0);
+ *       int id = ahl4a_coro::stream_id(r);
+ *       ahl4a_coro::spawn(wait_state(events, id));
+ *       co_await ahl4a_coro::set_stream_state(c, id, AHL_STREAM_STATE_RUNNING, false);
+ *   }
+ *   ahl4a_coro::spawn(flow(client, events));
+ *
+ * An event only reaches the waiters there are when it arrives. audio-4a pushes
+ * the state event before the reply of set_stream_state, so its waiter is
+ * spawned before the call. bench/ahl4a-coro-check.cpp runs this flow.
+ *
+ * A coroutine is resumed from the client callback that completes its await,
+ * on the thread running callbacks (the loop thread, the I/O thread or the
+ * executor, see init_threaded()), without thread hop nor queue. Awaiting
+ * needs no allocation: the awaiter lives in the coroutine frame and the
+ * reply handler it gives to the client only holds a pointer to it. Frames
+ * come from a per-thread pool of size classes and are reused once freed.
+ */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <stddef.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <optional>
+#include <string>
+#include <utility>
+#include "wsclient-audio4a.hpp"
+
+namespace ahl4a_coro {
+    /* coroutine frames, per-thread free lists in classes of Granule bytes */
+    class FramePool
+    {
+    public:
+        static constexpr size_t Granule = 64;
+        static constexpr size_t Classes = 32;   /* larger frames go to the heap */
+
+        static void* allocate(size_t size) {
+            size_t c = (size + Granule - 1) / Granule;
+            if (c >= Classes) return ::operator new(size);
+            Block*& head = lists().heads[c];
+            if (head) {
+                Block* b = head;
+                head = b->next;
+                return b;
+            }
+            return ::operator new(c * Granule);
+        }
+
+        static void release(void* p, size_t size) {
+            size_t c = (size + Granule - 1) / Granule;
+            if (c >= Classes) {
+                ::operator delete(p);
+                return;
+            }
+            Block* b = static_cast<Block*> (p);
+            Block*& head = lists().heads[c];
+            b->next = head;
+            head = b;
+        }
+
+    private:
+        struct Block {
+            Block* next;
+        };
+        struct Lists {
+            Block* heads[Classes] = {};
+            ~Lists() {
+                for (Block*& head : heads) {
+                    while (head) {
+                        Block* b = head;
+                        head = b->next;
+                        ::operator delete(b);
+                    }
+                }
+            }
+        };
+        static Lists& lists() {
+            static thread_local Lists l;
+            return l;
+        }
+    };
+
+    template <class T = void> class Task;
+
+    namespace detail {
+        struct PromiseBase {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+            bool detached = false;
+
+            static void* operator new(size_t size) { return FramePool::allocate(size); }
+            static void operator delete(void* p, size_t size) { FramePool::release(p, size); }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            /* back to the awaiting coroutine, a detached one frees itself */
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                template <class P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    PromiseBase& p = h.promise();
+                    if (p.continuation) return p.continuation;
+                    if (p.detached) h.destroy();
+                    return std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() {
+                /* nobody would ever see it */
+                if (detached) std::terminate();
+                error = std::current_exception();
+            }
+        };
+
+        template <class T>
+        struct Promise : PromiseBase {
+            std::optional<T> value;
+            Task<T> get_return_object();
+            void return_value(T v) { value.emplace(std::move(v)); }
+            T take() { return std::move(*value); }
+        };
+
+        template <>
+        struct Promise<void> : PromiseBase {
+            Task<void> get_return_object();
+            void return_void() {}
+            void take() {}
+        };
+
+        /* waiter list of each typed event in EventSource */
+        constexpr unsigned event_kind(const StreamStateEvent*) { return 0; }
+        constexpr unsigned event_kind(const EndpointVolumeEvent*) { return 1; }
+        constexpr unsigned event_kind(const EndpointPropertyEvent*) { return 2; }
+        constexpr unsigned event_kind(const PostActionEvent*) { return 3; }
+    }
+
+    /* lazy coroutine: starts when awaited or given to spawn() */
+    template <class T>
+    class Task
+    {
+    public:
+        using promise_type = detail::Promise<T>;
+
+        explicit Task(std::coroutine_handle<promise_type> h) : mhandle(h) {}
+        Task(Task&& other) noexcept : mhandle(std::exchange(other.mhandle, nullptr)) {}
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+        ~Task() {
+            if (mhandle) mhandle.destroy();
+        }
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            mhandle.promise().continuation = awaiting;
+            return mhandle;
+        }
+        T await_resume() {
+            if (mhandle.promise().error) std::rethrow_exception(mhandle.promise().error);
+            return mhandle.promise().take();
+        }
+
+        std::coroutine_handle<promise_type> release() { return std::exchange(mhandle, nullptr); }
+
+    private:
+        std::coroutine_handle<promise_type> mhandle;
+    };
+
+    template <class T>
+    inline Task<T> detail::Promise<T>::get_return_object() {
+        return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+    }
+
+    inline Task<void> detail::Promise<void>::get_return_object() {
+        return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+    }
+
+    /* runs a task up to its first suspension, its frame is freed when it returns */
+    inline void spawn(Task<void>&& task) {
+        std::coroutine_handle<detail::Promise<void>> h = task.release();
+        h.promise().detached = true;
+        h.resume();
+    }
+
+    /* status and reply of one call, the reply is held until the Result goes away */
+    class Result
+    {
+    public:
+        Result() = default;
+        Result(Result&& other) noexcept : status(other.status), reply(std::exchange(other.reply, nullptr)) {}
+        Result &operator=(Result&& other) noexcept {
+            std::swap(status, other.status);
+            std::swap(reply, other.reply);
+            return *this;
+        }
+        Result(const Result &) = delete;
+        Result &operator=(const Result &) = delete;
+        ~Result() {
+            if (reply) json_object_put(reply);
+        }
+
+        bool ok() const { return status == WsClientAudio4a::Reply_Ok; }
+
+        int status = WsClientAudio4a::Reply_Error;  /* WsClientAudio4a::ReplyStatus */
+        struct json_object* reply = nullptr;        /* NULL for local errors and unparsed replies */
+    };
+
+    /* stream_id out of a stream_open reply, -1 if none */
+    inline int stream_id(const Result& r) {
+        struct json_object *response, *jid;
+        if (!r.ok() || !json_object_object_get_ex(r.reply, "response", &response)) return -1;
+        if (!json_object_object_get_ex(response, "stream_id", &jid)) return -1;
+        return json_object_get_int(jid);
+    }
+
+    /*
+     * Awaits one call. Issue gets the reply handler and returns the request handle.
+     * Whichever of the issuing side and the reply comes last resumes the coroutine,
+     * so replies given inline or from another thread are both fine.
+     */
+    template <class Issue>
+    class CallAwaiter
+    {
+    public:
+        explicit CallAwaiter(Issue issue) : missue(std::move(issue)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            mhandle = h;
+            WsClientAudio4a::RequestHandle r = missue([this](int status, struct json_object* reply) {
+                mresult.status = status;
+                mresult.reply = reply ? json_object_get(reply) : nullptr;
+                if (mdone.exchange(true, std::memory_order_acq_rel)) {
+                    mhandle.resume();
+                }
+            });
+            if (r == WsClientAudio4a::InvalidRequest) {
+                if (!mdone.exchange(true, std::memory_order_acq_rel)) {
+                    mresult.status = WsClientAudio4a::Reply_Error;
+                }
+                return false;
+            }
+            return !mdone.exchange(true, std::memory_order_acq_rel);
+        }
+
+        Result await_resume() { return std::move(mresult); }
+
+    private:
+        Issue missue;
+        std::coroutine_handle<> mhandle;
+        std::atomic<bool> mdone{false};
+        Result mresult;
+    };
+
+    template <class Issue>
+    inline CallAwaiter<Issue> await_call(Issue issue) {
+        return CallAwaiter<Issue>(std::move(issue));
+    }
+
+    /* arguments are referenced until the reply, the co_await expression keeps them alive */
+    inline auto stream_open(WsClientAudio4a& c, const std::string& audioRole, EndPointType4aT endPointType, int endpointID) {
+        return await_call([&c, &audioRole, endPointType, endpointID](WsClientAudio4a::reply_fun&& f) {
+            return c.stream_open(audioRole, endPointType, endpointID, std::move(f));
+        });
+    }
+
+    inline auto stream_close(WsClientAudio4a& c, int streamID) {
+        return await_call([&c, streamID](WsClientAudio4a::reply_fun&& f) {
+            return c.stream_close(streamID, std::move(f));
+        });
+    }
+
+    inline auto set_stream_state(WsClientAudio4a& c, int streamID, const std::string& state, bool mute) {
+        return await_call([&c, streamID, &state, mute](WsClientAudio4a::reply_fun&& f) {
+            return c.set_stream_state(streamID, state, mute, std::move(f));
+        });
+    }
+
+    inline auto volume(WsClientAudio4a& c, EndPointType4aT endPointType, int endpointID, int volume) {
+        return await_call([&c, endPointType, endpointID, volume](WsClientAudio4a::reply_fun&& f) {
+            return c.volume(endPointType, endpointID, volume, std::move(f));
+        });
+    }
+
+    inline auto property(WsClientAudio4a& c, EndPointType4aT endPointType, int endpointID, const std::string& propertyName, double value) {
+        return await_call([&c, endPointType, endpointID, &propertyName, value](WsClientAudio4a::reply_fun&& f) {
+            return c.property(endPointType, endpointID, propertyName, value, std::move(f));
+        });
+    }
+
+    inline auto get_endpoints(WsClientAudio4a& c, const std::string& audioRole, EndPointType4aT endPointType) {
+        return await_call([&c, &audioRole, endPointType](WsClientAudio4a::reply_fun&& f) {
+            return c.get_endpoints(audioRole, endPointType, std::move(f));
+        });
+    }
+
+    inline auto get_endpoint_info(WsClientAudio4a& c, int endpointID, EndPointType4aT endPointType) {
+        return await_call([&c, endpointID, endPointType](WsClientAudio4a::reply_fun&& f) {
+            return c.get_endpoint_info(endpointID, endPointType, std::move(f));
+        });
+    }
+
+    inline auto get_stream_info(WsClientAudio4a& c, int streamID) {
+        return await_call([&c, streamID](WsClientAudio4a::reply_fun&& f) {
+            return c.get_stream_info(streamID, std::move(f));
+        });
+    }
+
+    /* ownership of arg is taken as by WsClientAudio4a::call() */
+    inline auto call(WsClientAudio4a& c, Audio4aVerbT verb, struct json_object* arg) {
+        return await_call([&c, verb, arg](WsClientAudio4a::reply_fun&& f) {
+            return c.call(verb, arg, std::move(f));
+        });
+    }
+
+    /*
+     * Typed events for coroutines. Listens to the typed events of the client
+     * (add_stream_state_listener()...) and hands each event to the waiters
+     * registered before it arrived whose predicate accepts it. Waiters and their
+     * predicates live in the awaiting frames, in intrusive lists.
+     * The string views of an event borrow the message: they are valid until the
+     * resumed coroutine suspends again. Await from the thread running callbacks.
+     */
+    class EventSource
+    {
+    private:
+        struct Waiter {
+            Waiter* prev = nullptr;
+            Waiter* next = nullptr;
+            EventSource* source = nullptr;
+            unsigned kind = 0;
+            uint64_t seq = 0;
+            uint64_t visited = 0;
+            void* owner = nullptr;
+            bool (*match)(void* owner, const void* ev) = nullptr;
+            const void* event = nullptr;
+            std::coroutine_handle<> handle;
+        };
+
+    public:
+        template <class Event, class Pred>
+        class NextEvent
+        {
+        public:
+            NextEvent(EventSource* source, Pred pred) : mpred(std::move(pred)) {
+                mwaiter.source = source;
+                mwaiter.kind = detail::event_kind(static_cast<const Event*> (nullptr));
+                mwaiter.match = [](void* owner, const void* ev) {
+                    return static_cast<bool>(static_cast<NextEvent*> (owner)->mpred(*static_cast<const Event*> (ev)));
+                };
+            }
+            NextEvent(const NextEvent &) = delete;
+            NextEvent &operator=(const NextEvent &) = delete;
+            /* a frame destroyed while waiting leaves the list */
+            ~NextEvent() {
+                if (mwaiter.seq && !mwaiter.event) mwaiter.source->unlink(&mwaiter);
+            }
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                mwaiter.owner = this;
+                mwaiter.handle = h;
+                mwaiter.source->link(&mwaiter);
+            }
+            Event await_resume() const { return *static_cast<const Event*> (mwaiter.event); }
+
+        private:
+            Waiter mwaiter;
+            Pred mpred;
+        };
+
+        explicit EventSource(WsClientAudio4a& client) : mclient(client) {
+            mlisteners[0] = client.add_stream_state_listener([this](const StreamStateEvent& ev) { dispatch(ev); });
+            mlisteners[1] = client.add_endpoint_volume_listener([this](const EndpointVolumeEvent& ev) { dispatch(ev); });
+            mlisteners[2] = client.add_endpoint_property_listener([this](const EndpointPropertyEvent& ev) { dispatch(ev); });
+            mlisteners[3] = client.add_post_action_listener([this](const PostActionEvent& ev) { dispatch(ev); });
+        }
+        ~EventSource() {
+            for (WsClientAudio4a::ListenerId id : mlisteners) mclient.remove_listener(id);
+        }
+        EventSource(const EventSource &) = delete;
+        EventSource &operator=(const EventSource &) = delete;
+
+        /* next event of type Event (StreamStateEvent, EndpointVolumeEvent...) accepted by pred */
+        template <class Event, class Pred>
+        NextEvent<Event, Pred> next(Pred pred) { return NextEvent<Event, Pred>(this, std::move(pred)); }
+
+        template <class Event>
+        auto next() { return next<Event>([](const Event&) { return true; }); }
+
+    private:
+        static const unsigned Kinds = 4;
+
+        void link(Waiter* w) {
+            w->seq = ++mseq;
+            w->prev = mtails[w->kind];
+            w->next = nullptr;
+            if (w->prev) w->prev->next = w;
+            else mheads[w->kind] = w;
+            mtails[w->kind] = w;
+        }
+
+        void unlink(Waiter* w) {
+            if (w->prev) w->prev->next = w->next;
+            else mheads[w->kind] = w->next;
+            if (w->next) w->next->prev = w->prev;
+            else mtails[w->kind] = w->prev;
+            w->prev = w->next = nullptr;
+        }
+
+        /* resumed coroutines may add or drop waiters, so restart from the head each time */
+        template <class Event>
+        void dispatch(const Event& ev) {
+            const unsigned kind = detail::event_kind(&ev);
+            uint64_t stamp = ++mseq;
+            for (;;) {
+                Waiter* w = mheads[kind];
+                while (w && (w->seq > stamp || w->visited == stamp)) {
+                    w = w->next;
+                }
+                if (!w) break;
+                w->visited = stamp;
+                if (w->match(w->owner, &ev)) {
+                    unlink(w);
+                    w->event = &ev;
+                    w->handle.resume();
+                }
+            }
+        }
+
+        WsClientAudio4a& mclient;
+        WsClientAudio4a::ListenerId mlisteners[Kinds];
+        Waiter* mheads[Kinds] = {};
+        Waiter* mtails[Kinds] = {};
+        uint64_t mseq = 0;
+    };
+}
+
+#endif /* __cpp_impl_coroutine */
+#endif /* AHL4A_CORO_H */
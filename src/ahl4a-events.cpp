@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <charconv>
+#include "ahl-interface.h"
+#include "ahl4a-events.hpp"
+
+using namespace std;
+
+/* position after the whitespace starting at pos */
+static size_t skip_ws(string_view s, size_t pos) {
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+        pos++;
+    return pos;
+}
+
+/* position after the string starting at pos (on the opening quote), npos if malformed */
+static size_t skip_string(string_view s, size_t pos) {
+    for (pos++; pos < s.size(); pos++) {
+        if (s[pos] == '\\')
+            pos++;
+        else if (s[pos] == '"')
+            return pos + 1;
+    }
+    return string_view::npos;
+}
+
+/* position after the value starting at pos, npos if malformed */
+static size_t skip_value(string_view s, size_t pos) {
+    if (pos >= s.size())
+        return string_view::npos;
+    if (s[pos] == '"')
+        return skip_string(s, pos);
+    if (s[pos] == '{' || s[pos] == '[') {
+        int depth = 0;
+        while (pos < s.size()) {
+            char c = s[pos];
+            if (c == '"') {
+                pos = skip_string(s, pos);
+                if (pos == string_view::npos)
+                    return pos;
+                continue;
+            }
+            if (c == '{' || c == '[')
+                depth++;
+            else if (c == '}' || c == ']') {
+                if (--depth == 0)
+                    return pos + 1;
+            }
+            pos++;
+        }
+        return string_view::npos;
+    }
+    /* number, true, false, null */
+    while (pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']'
+           && s[pos] != ' ' && s[pos] != '\t' && s[pos] != '\n' && s[pos] != '\r')
+        pos++;
+    return pos;
+}
+
+bool ahl4a_scan::member(string_view obj, string_view key, string_view* value) {
+    size_t pos = skip_ws(obj, 0);
+    if (pos >= obj.size() || obj[pos] != '{')
+        return false;
+    pos = skip_ws(obj, pos + 1);
+    while (pos < obj.size() && obj[pos] == '"') {
+        size_t kend = skip_string(obj, pos);
+        if (kend == string_view::npos)
+            return false;
+        string_view k = obj.substr(pos + 1, kend - pos - 2);
+        pos = skip_ws(obj, kend);
+        if (pos >= obj.size() || obj[pos] != ':')
+            return false;
+        pos = skip_ws(obj, pos + 1);
+        size_t vend = skip_value(obj, pos);
+        if (vend == string_view::npos)
+            return false;
+        if (k == key) {
+            *value = obj.substr(pos, vend - pos);
+            return true;
+        }
+        pos = skip_ws(obj, vend);
+        if (pos >= obj.size() || obj[pos] != ',')
+            return false;
+        pos = skip_ws(obj, pos + 1);
+    }
+    return false;
+}
+
+bool ahl4a_scan::element(string_view array, size_t index, string_view* value) {
+    size_t pos = skip_ws(array, 0);
+    if (pos >= array.size() || array[pos] != '[')
+        return false;
+    pos = skip_ws(array, pos + 1);
+    for (size_t i = 0; pos < array.size() && array[pos] != ']'; i++) {
+        size_t vend = skip_value(array, pos);
+        if (vend == string_view::npos)
+            return false;
+        if (i == index) {
+            *value = array.substr(pos, vend - pos);
+            return true;
+        }
+        pos = skip_ws(array, vend);
+        if (pos >= array.size() || array[pos] != ',')
+            return false;
+        pos = skip_ws(array, pos + 1);
+    }
+    return false;
+}
+
+/* whole value only, "1.5" or "12abc" are not ints */
+bool ahl4a_scan::as_int(string_view value, int* out) {
+    const char* end = value.data() + value.size();
+    from_chars_result r = from_chars(value.data(), end, *out);
+    return r.ec == errc() && r.ptr == end;
+}
+
+/* whole value only and whatever LC_NUMERIC says, JSON numbers always use '.', needs GCC 11 */
+bool ahl4a_scan::as_double(string_view value, double* out) {
+    const char* end = value.data() + value.size();
+    from_chars_result r = from_chars(value.data(), end, *out);
+    return r.ec == errc() && r.ptr == end;
+}
+
+bool ahl4a_scan::as_bool(string_view value, bool* out) {
+    int i;
+    string_view str;
+    if (value == "true" || value == "false") {
+        *out = (value == "true");
+        return true;
+    }
+    if (as_string(value, &str) && (str == AHL_STREAM_MUTED || str == AHL_STREAM_UNMUTED)) {
+        *out = (str == AHL_STREAM_MUTED);
+        return true;
+    }
+    if (as_int(value, &i)) {
+        *out = (i != 0);
+        return true;
+    }
+    return false;
+}
+
+bool ahl4a_scan::as_string(string_view value, string_view* out) {
+    if (value.size() < 2 || value.front() != '"' || value.back() != '"')
+        return false;
+    *out = value.substr(1, value.size() - 2);
+    return true;
+}
+
+/* "data" member of the event object */
+static bool event_data(string_view message, string_view* data) {
+    return ahl4a_scan::member(message, "data", data);
+}
+
+static void get_int(string_view obj, string_view key, int* out) {
+    string_view v;
+    if (ahl4a_scan::member(obj, key, &v))
+        ahl4a_scan::as_int(v, out);
+}
+
+static void get_string(string_view obj, string_view key, string_view* out) {
+    string_view v;
+    if (ahl4a_scan::member(obj, key, &v) && !ahl4a_scan::as_string(v, out))
+        *out = v; /* not a string, hand the raw value */
+}
+
+bool decode_event(string_view message, StreamStateEvent* ev) {
+    string_view data, v;
+    if (!event_data(message, &data))
+        return false;
+    get_int(data, "stream_id", &ev->stream_id);
+    get_string(data, "state", &ev->state);
+    if (ahl4a_scan::member(data, "mute", &v))
+        ahl4a_scan::as_bool(v, &ev->mute);
+    return true;
+}
+
+bool decode_event(string_view message, EndpointVolumeEvent* ev) {
+    string_view data;
+    if (!event_data(message, &data))
+        return false;
+    get_int(data, "endpoint_id", &ev->endpoint_id);
+    get_string(data, "endpoint_type", &ev->endpoint_type);
+    get_string(data, "audio_role", &ev->audio_role);
+    get_int(data, "value", &ev->value);
+    return true;
+}
+
+bool decode_event(string_view message, EndpointPropertyEvent* ev) {
+    string_view data, v;
+    if (!event_data(message, &data))
+        return false;
+    get_int(data, "endpoint_id", &ev->endpoint_id);
+    get_string(data, "endpoint_type", &ev->endpoint_type);
+    get_string(data, "property_name", &ev->property_name);
+    if (ahl4a_scan::member(data, "value", &v))
+        ahl4a_scan::as_double(v, &ev->value);
+    return true;
+}
+
+bool decode_event(string_view message, PostActionEvent* ev) {
+    string_view data;
+    if (!event_data(message, &data))
+        return false;
+    get_string(data, "action_name", &ev->action_name);
+    get_string(data, "audio_role", &ev->audio_role);
+    get_string(data, "media_name", &ev->media_name);
+    ahl4a_scan::member(data, "action_context", &ev->action_context);
+    return true;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_EVENTS_H
+#define AHL4A_EVENTS_H
+#include <string_view>
+
+/*
+ * Typed ahl4a events decoded straight from the message text.
+ * String views borrow the message and are only valid during the event callback.
+ * Fields missing from the message keep their default value.
+ */
+
+struct StreamStateEvent {
+    int stream_id = -1;
+    std::string_view state;             /* AHL_STREAM_STATE_* or AHL_STREAM_EVENT_* */
+    bool mute = false;
+};
+
+struct EndpointVolumeEvent {
+    int endpoint_id = -1;
+    std::string_view endpoint_type;     /* AHL_ENDPOINTTYPE_* */
+    std::string_view audio_role;
+    int value = 0;
+};
+
+struct EndpointPropertyEvent {
+    int endpoint_id = -1;
+    std::string_view endpoint_type;     /* AHL_ENDPOINTTYPE_* */
+    std::string_view property_name;     /* AHL_PROPERTY_* */
+    double value = 0;
+};
+
+struct PostActionEvent {
+    std::string_view action_name;       /* AHL_EVENTS_* */
+    std::string_view audio_role;
+    std::string_view media_name;
+    std::string_view action_context;    /* raw JSON value */
+};
+
+/*
+ * On-demand scanner over JSON text: walks one object level and returns raw
+ * value spans, nothing is allocated and nothing outside the path is decoded.
+ */
+namespace ahl4a_scan {
+    /* raw text of member 'key' in object 'obj' */
+    bool member(std::string_view obj, std::string_view key, std::string_view* value);
+    /* raw text of element 'index' in array 'array' */
+    bool element(std::string_view array, size_t index, std::string_view* value);
+    bool as_int(std::string_view value, int* out);
+    bool as_double(std::string_view value, double* out);
+    /* true/false, non-zero number or AHL_STREAM_MUTED/UNMUTED strings */
+    bool as_bool(std::string_view value, bool* out);
+    /* content of a string value, escapes are left as is */
+    bool as_string(std::string_view value, std::string_view* out);
+}
+
+/* 'message' is the event object text: {"event":"ahl4a/...","data":{...},"jtype":"afb-event"} */
+bool decode_event(std::string_view message, StreamStateEvent* ev);
+bool decode_event(std::string_view message, EndpointVolumeEvent* ev);
+bool decode_event(std::string_view message, EndpointPropertyEvent* ev);
+bool decode_event(std::string_view message, PostActionEvent* ev);
+
+#endif /* AHL4A_EVENTS_H */
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_JSON_H
+#define AHL4A_JSON_H
+#include <math.h>
+#include <charconv>
+#include <string>
+#include <string_view>
+
+/*
+ * Request serializers.
+ * Each request is written as JSON text straight into a caller provided string,
+ * which is cleared and reused from call to call so that, once it has grown to
+ * the largest request, nothing is allocated. Member names are quoted at compile
+ * time and the member order and types of each request are fixed by the
+ * template instantiation, no format string is parsed and no json-c tree built.
+ */
+namespace ahl4a_json {
+    /* quoted member name followed by ':' */
+    struct Key {
+        const char* text;
+        size_t len;
+    };
+
+    template <class T>
+    struct Field {
+        Key key;
+        const T& value;
+    };
+
+    template <class C>
+    struct List {
+        const C& items;
+    };
+
+    template <class T>
+    inline Field<T> field(Key key, const T& value) { return Field<T>{key, value}; }
+
+    template <class C>
+    inline List<C> list(const C& items) { return List<C>{items}; }
+
+    inline void put(std::string& out, int v) {
+        char tmp[16];
+        std::to_chars_result r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+        out.append(tmp, (size_t)(r.ptr - tmp));
+    }
+
+    inline void put(std::string& out, bool v) {
+        if (v) out.append("true", 4);
+        else out.append("false", 5);
+    }
+
+    /* shortest text that reads back the same, '.' whatever LC_NUMERIC, 3.0 stays a double as with json-c */
+    inline void put(std::string& out, double v) {
+        char tmp[32];
+        if (!isfinite(v)) {
+            out.append("null", 4);
+            return;
+        }
+        std::to_chars_result r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+        size_t n = (size_t)(r.ptr - tmp);
+        out.append(tmp, n);
+        if (std::string_view(tmp, n).find_first_of(".e") == std::string_view::npos) {
+            out.append(".0", 2);
+        }
+    }
+
+    inline void put(std::string& out, std::string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        out.push_back('"');
+        size_t start = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            unsigned char c = (unsigned char)s[i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            out.append(s.data() + start, i - start);
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back((char)c);
+            } else {
+                char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                out.append(esc, sizeof(esc));
+            }
+            start = i + 1;
+        }
+        out.append(s.data() + start, s.size() - start);
+        out.push_back('"');
+    }
+
+    inline void put(std::string& out, const char* s) { put(out, std::string_view(s)); }
+    inline void put(std::string& out, const std::string& s) { put(out, std::string_view(s)); }
+
+    template <class C>
+    inline void put(std::string& out, const List<C>& l) {
+        out.push_back('[');
+        bool first = true;
+        for (const auto& item : l.items) {
+            if (!first) out.push_back(',');
+            put(out, item);
+            first = false;
+        }
+        out.push_back(']');
+    }
+
+    template <class T>
+    inline void put_member(std::string& out, const Field<T>& f, bool first) {
+        if (!first) out.push_back(',');
+        out.append(f.key.text, f.key.len);
+        put(out, f.value);
+    }
+
+    template <class T0, class... T>
+    inline void object(std::string& out, const Field<T0>& f0, const Field<T>&... fields) {
+        out.push_back('{');
+        put_member(out, f0, true);
+        (put_member(out, fields, false), ...);
+        out.push_back('}');
+    }
+}
+
+#define AHL4A_JSON_KEY(name) ahl4a_json::Key{"\"" name "\":", sizeof("\"" name "\":") - 1}
+
+/* ahl4a requests, same members as audio-4a expects them */
+namespace ahl4a_json {
+    inline void stream_open(std::string& out, std::string_view audioRole, std::string_view endpointType, int endpointID) {
+        object(out, field(AHL4A_JSON_KEY("audio_role"), audioRole),
+                    field(AHL4A_JSON_KEY("endpoint_type"), endpointType),
+                    field(AHL4A_JSON_KEY("endpoint_id"), endpointID));
+    }
+
+    inline void stream_close(std::string& out, int streamID) {
+        object(out, field(AHL4A_JSON_KEY("stream_id"), streamID));
+    }
+
+    inline void stream_state(std::string& out, int streamID, std::string_view state, bool mute) {
+        object(out, field(AHL4A_JSON_KEY("stream_id"), streamID),
+                    field(AHL4A_JSON_KEY("state"), state),
+                    field(AHL4A_JSON_KEY("mute"), mute));
+    }
+
+    /* events is any container of strings, "subscribe" is an integer for the binding */
+    template <class C>
+    inline void subscription(std::string& out, const C& events, bool subscribe) {
+        object(out, field(AHL4A_JSON_KEY("events"), list(events)),
+                    field(AHL4A_JSON_KEY("subscribe"), subscribe ? 1 : 0));
+    }
+
+    inline void volume(std::string& out, std::string_view endpointType, int endpointID, int volume) {
+        object(out, field(AHL4A_JSON_KEY("endpoint_type"), endpointType),
+                    field(AHL4A_JSON_KEY("endpoint_id"), endpointID),
+                    field(AHL4A_JSON_KEY("volume"), volume));
+    }
+
+    inline void property(std::string& out, std::string_view endpointType, int endpointID, std::string_view name, double value) {
+        object(out, field(AHL4A_JSON_KEY("endpoint_type"), endpointType),
+                    field(AHL4A_JSON_KEY("endpoint_id"), endpointID),
+                    field(AHL4A_JSON_KEY("property_name"), name),
+                    field(AHL4A_JSON_KEY("value"), value));
+    }
+}
+
+#endif /* AHL4A_JSON_H */
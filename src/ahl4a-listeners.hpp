@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_LISTENERS_H
+#define AHL4A_LISTENERS_H
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Listeners of one event type, bucketed by key (stream or endpoint ID).
+ * dispatch() looks up the bucket of the event key and the AnyKey one, so an
+ * event only reaches its own listeners whatever their total number.
+ * Listeners may add or remove listeners while called: removed ones are
+ * skipped at once and dropped once the outermost dispatch() is done, added
+ * ones get the next event.
+ */
+template <class Event>
+class ListenerIndex
+{
+public:
+    using Fn = std::function<void(const Event&)>;
+    static const int AnyKey = -1;
+
+    ListenerIndex() : mdispatching(0), mremoved(false) {}
+    ListenerIndex(const ListenerIndex &) = delete;
+    ListenerIndex &operator=(const ListenerIndex &) = delete;
+
+    bool empty() const { return mkeys.empty(); }
+    size_t size() const { return mkeys.size(); }
+
+    /* id is chosen by the caller, unique among all the listeners it keeps */
+    void add(uint64_t id, int key, Fn&& fn) {
+        if (key < 0) key = AnyKey;
+        mbuckets[key].emplace_back(new Entry{id, false, std::move(fn)});
+        mkeys[id] = key;
+    }
+
+    bool remove(uint64_t id) {
+        auto k = mkeys.find(id);
+        if (k == mkeys.end()) return false;
+        auto b = mbuckets.find(k->second);
+        mkeys.erase(k);
+        std::vector<std::unique_ptr<Entry>>& bucket = b->second;
+        for (size_t i = 0; i < bucket.size(); i++) {
+            if (bucket[i]->id != id) continue;
+            if (mdispatching) {
+                /* may be running right now, kept until the dispatch is over */
+                bucket[i]->removed = true;
+                mremoved = true;
+            } else {
+                bucket.erase(bucket.begin() + (ptrdiff_t)i);
+                if (bucket.empty()) mbuckets.erase(b);
+            }
+            break;
+        }
+        return true;
+    }
+
+    void dispatch(int key, const Event& ev) {
+        if (mkeys.empty()) return;
+        mdispatching++;
+        if (key >= 0) call(key, ev);
+        call(AnyKey, ev);
+        if (--mdispatching == 0 && mremoved) purge();
+    }
+
+private:
+    struct Entry {
+        uint64_t id;
+        bool removed;
+        Fn fn;
+    };
+
+    void call(int key, const Event& ev) {
+        auto b = mbuckets.find(key);
+        if (b == mbuckets.end()) return;
+        /* the bucket stays in place while listeners add keys, its entries while it grows */
+        std::vector<std::unique_ptr<Entry>>& bucket = b->second;
+        size_t n = bucket.size();
+        for (size_t i = 0; i < n; i++) {
+            Entry* e = bucket[i].get();
+            if (!e->removed) e->fn(ev);
+        }
+    }
+
+    void purge() {
+        mremoved = false;
+        for (auto b = mbuckets.begin(); b != mbuckets.end();) {
+            std::vector<std::unique_ptr<Entry>>& bucket = b->second;
+            size_t j = 0;
+            for (size_t i = 0; i < bucket.size(); i++) {
+                if (!bucket[i]->removed) bucket[j++] = std::move(bucket[i]);
+            }
+            bucket.resize(j);
+            b = bucket.empty() ? mbuckets.erase(b) : std::next(b);
+        }
+    }
+
+    std::unordered_map<int, std::vector<std::unique_ptr<Entry>>> mbuckets;
+    std::unordered_map<uint64_t, int> mkeys;    /* listener -> bucket */
+    int mdispatching;
+    bool mremoved;
+};
+
+#endif /* AHL4A_LISTENERS_H */
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "ahl4a-log.hpp"
+
+using namespace std;
+
+namespace ahl4a_log {
+
+/*
+ * Bounded MPSC ring (Vyukov). A slot may be written when its sequence equals
+ * the producer position and read when it equals position + 1. Sequences are
+ * stored minus the slot index so that the zero-initialized ring is valid.
+ */
+static const size_t Capacity = 512;
+static const size_t Mask = Capacity - 1;
+static const size_t TextSize = RecordSize - sizeof(atomic<size_t>) - 2 * sizeof(uint16_t);
+static_assert((Capacity & Mask) == 0, "ring capacity must be a power of two");
+
+struct Record {
+    atomic<size_t> seq;
+    uint16_t len;
+    uint16_t level;
+    char text[TextSize];
+};
+
+static Record ring[Capacity];
+static atomic<size_t> enqueue_pos{0};
+static size_t dequeue_pos = 0;
+static atomic_flag draining = ATOMIC_FLAG_INIT;
+static const int ExitWaitMs = 200;  /* longest wait at exit for a drain in progress */
+static atomic<uint64_t> ndropped{0};
+static uint64_t reported_dropped = 0;
+
+static atomic<sink_fun> sink{nullptr};
+static atomic<void*> sink_closure{nullptr};
+
+enum WriterState { Writer_None, Writer_Starting, Writer_Running, Writer_Failed };
+static atomic<int> writer_state{Writer_None};
+static atomic<bool> writer_armed{false};
+static atomic<int> writer_fd{-1};
+
+static const char* const level_names[] = {"ERROR", "WARNING", "NOTICE", "INFO", "DEBUG"};
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Burst records per site and second, *suppressed gets what was skipped before */
+static bool admit(Site* site, uint32_t* suppressed) {
+    uint64_t now = now_ms();
+    uint64_t start = site->window_ms.load(memory_order_relaxed);
+    if (now - start >= 1000 && site->window_ms.compare_exchange_strong(start, now, memory_order_relaxed)) {
+        site->count.store(1, memory_order_relaxed);
+        *suppressed = site->suppressed.exchange(0, memory_order_relaxed);
+        return true;
+    }
+    if (site->count.fetch_add(1, memory_order_relaxed) >= (uint32_t)Burst) {
+        site->suppressed.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    *suppressed = 0;
+    return true;
+}
+
+static void emit(int level, const char* text, size_t len, char* out, size_t* used, size_t out_size) {
+    sink_fun f = sink.load(memory_order_acquire);
+    if (f) {
+        f(level, text, len, sink_closure.load(memory_order_acquire));
+        return;
+    }
+    if (*used + len + 1 > out_size) {
+        fwrite(out, 1, *used, stdout);
+        *used = 0;
+    }
+    memcpy(out + *used, text, len);
+    *used += len;
+    out[(*used)++] = '\n';
+}
+
+static void writer_main(int fd) {
+    for (;;) {
+        uint64_t count;
+        if (read(fd, &count, sizeof(count)) < 0 && errno != EINTR) {
+            return;
+        }
+        writer_armed.exchange(false, memory_order_acq_rel);
+        drain();
+    }
+}
+
+static size_t drain_records();
+
+/* the writer may be in the middle of a drain, wait for it so that no record is left behind */
+static void drain_at_exit() {
+    for (int waited_ms = 0; draining.test_and_set(memory_order_acquire); waited_ms++) {
+        if (waited_ms == ExitWaitMs) {
+            return;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    drain_records();
+    draining.clear(memory_order_release);
+}
+
+static void signal_writer(int fd) {
+    uint64_t one = 1;
+    if (::write(fd, &one, sizeof(one)) < 0) {
+        /* the counter is saturated, the writer is awake anyway */
+    }
+}
+
+/* records logged while starting are picked up by the first wake-up */
+static void start_writer() {
+    atexit(drain_at_exit);
+    int fd = eventfd(0, EFD_CLOEXEC);
+    if (fd >= 0) {
+        try {
+            thread(writer_main, fd).detach();
+        } catch (...) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        writer_state.store(Writer_Failed, memory_order_release);
+        drain();
+        return;
+    }
+    writer_fd.store(fd, memory_order_release);
+    writer_state.store(Writer_Running, memory_order_release);
+    writer_armed.store(true, memory_order_release);
+    signal_writer(fd);
+}
+
+static void wake_writer() {
+    int state = writer_state.load(memory_order_acquire);
+    if (state == Writer_None) {
+        if (writer_state.compare_exchange_strong(state, Writer_Starting, memory_order_acq_rel)) {
+            start_writer();
+            return;
+        }
+    }
+    if (state == Writer_Failed) {
+        /* no writer thread, stay usable */
+        drain();
+        return;
+    }
+    if (state != Writer_Running) {
+        return;
+    }
+    if (!writer_armed.exchange(true, memory_order_acq_rel)) {
+        signal_writer(writer_fd.load(memory_order_acquire));
+    }
+}
+
+void write(Site* site, Level level, const char* func, int line, const char* fmt, ...) {
+    uint32_t suppressed;
+    if (!admit(site, &suppressed)) {
+        return;
+    }
+
+    size_t pos = enqueue_pos.load(memory_order_relaxed);
+    Record* r;
+    for (;;) {
+        r = &ring[pos & Mask];
+        size_t seq = r->seq.load(memory_order_acquire) + (pos & Mask);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            ndropped.fetch_add(1, memory_order_relaxed);
+            return;
+        } else {
+            pos = enqueue_pos.load(memory_order_relaxed);
+        }
+    }
+
+    int n = snprintf(r->text, TextSize, "[%s: soundmanager]%s(%d):", level_names[level], func, line);
+    size_t len = (n < 0) ? 0 : min((size_t)n, TextSize - 1);
+    va_list args;
+    va_start(args, fmt);
+    n = vsnprintf(r->text + len, TextSize - len, fmt, args);
+    va_end(args);
+    len = (n < 0) ? len : min(len + (size_t)n, TextSize - 1);
+    if (suppressed) {
+        n = snprintf(r->text + len, TextSize - len, " (%u similar suppressed)", suppressed);
+        len = (n < 0) ? len : min(len + (size_t)n, TextSize - 1);
+    }
+    r->len = (uint16_t)len;
+    r->level = (uint16_t)level;
+    r->seq.store(pos + 1 - (pos & Mask), memory_order_release);
+
+    wake_writer();
+}
+
+void set_sink(sink_fun f, void* closure) {
+    sink_closure.store(closure, memory_order_release);
+    sink.store(f, memory_order_release);
+}
+
+/* caller holds draining */
+static size_t drain_records() {
+    char out[4096];
+    size_t used = 0;
+    size_t count = 0;
+
+    for (;;) {
+        Record* r = &ring[dequeue_pos & Mask];
+        size_t seq = r->seq.load(memory_order_acquire) + (dequeue_pos & Mask);
+        if (seq != dequeue_pos + 1) {
+            break;
+        }
+        emit(r->level, r->text, r->len, out, &used, sizeof(out));
+        r->seq.store(dequeue_pos + Capacity - (dequeue_pos & Mask), memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+    uint64_t lost = ndropped.load(memory_order_relaxed);
+    if (lost != reported_dropped) {
+        char text[96];
+        int n = snprintf(text, sizeof(text), "[WARNING: soundmanager]%llu log records dropped",
+                         (unsigned long long)(lost - reported_dropped));
+        reported_dropped = lost;
+        emit(Warning, text, (size_t)n, out, &used, sizeof(out));
+    }
+    if (used) {
+        fwrite(out, 1, used, stdout);
+        fflush(stdout);
+    }
+    return count;
+}
+
+size_t drain() {
+    /* only one consumer at a time, producers never wait on this */
+    if (draining.test_and_set(memory_order_acquire)) {
+        return 0;
+    }
+    size_t count = drain_records();
+    draining.clear(memory_order_release);
+    return count;
+}
+
+uint64_t dropped() {
+    return ndropped.load(memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_LOG_H
+#define AHL4A_LOG_H
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/*
+ * Asynchronous logging.
+ * A record is formatted by the caller straight into a slot of a fixed lock-free
+ * ring, nothing is allocated and nothing is flushed on the logging thread.
+ * A background writer (stdout, or the sink given to set_sink()) drains the ring.
+ * When the ring is full records are dropped and counted. Each call site logs at
+ * most Burst records per second, the rest is counted and reported with the next
+ * record of that site.
+ */
+namespace ahl4a_log {
+    enum Level {
+        Error = 0,
+        Warning,
+        Notice,
+        Info,
+        Debug
+    };
+
+    static const int Burst = 10;
+    static const size_t RecordSize = 256;
+
+    /* per call site rate limiter, one static instance per AHL4A_LOG() */
+    struct Site {
+        std::atomic<uint64_t> window_ms{0};
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint32_t> suppressed{0};
+    };
+
+    /* text is not NUL terminated, called from the writer thread or drain() */
+    typedef void (*sink_fun)(int level, const char* text, size_t len, void* closure);
+
+    void write(Site* site, Level level, const char* func, int line, const char* fmt, ...)
+        __attribute__((format(printf, 5, 6)));
+    /* NULL goes back to stdout */
+    void set_sink(sink_fun sink, void* closure);
+    /* hands pending records to the sink from the calling thread, returns their count */
+    size_t drain();
+    uint64_t dropped();
+}
+
+/* levels above AHL4A_LOG_LEVEL are compiled out */
+#ifndef AHL4A_LOG_LEVEL
+#ifdef DEBUGMODE
+#define AHL4A_LOG_LEVEL ahl4a_log::Debug
+#else
+#define AHL4A_LOG_LEVEL ahl4a_log::Notice
+#endif
+#endif
+
+#define AHL4A_LOG(level, fmt, ...) \
+    do { \
+        if ((level) <= AHL4A_LOG_LEVEL) { \
+            static ahl4a_log::Site _ahl4a_log_site; \
+            ahl4a_log::write(&_ahl4a_log_site, (level), __FUNCTION__, __LINE__, fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif /* AHL4A_LOG_H */
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_MPSC_H
+#define AHL4A_MPSC_H
+#include <atomic>
+
+/*
+ * Intrusive multi-producer single-consumer queue (Vyukov).
+ * push() is wait-free and may be called from any thread, pop() only from the
+ * consumer. T needs a 'std::atomic<T*> next' member and a default constructor,
+ * one T is kept as stub. Nodes are owned by the caller, nothing is allocated.
+ */
+template <class T>
+class MpscQueue
+{
+public:
+    MpscQueue() : mhead(&mstub), mtail(&mstub) {
+        mstub.next.store(nullptr, std::memory_order_relaxed);
+    }
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        T* prev = mhead.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /* NULL when empty, or while a producer is between its two steps */
+    T* pop() {
+        T* tail = mtail;
+        T* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &mstub) {
+            if (!next)
+                return nullptr;
+            mtail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            mtail = next;
+            return tail;
+        }
+        if (tail != mhead.load(std::memory_order_acquire))
+            return nullptr;
+        push(&mstub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            mtail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    std::atomic<T*> mhead;
+    T* mtail;
+    T mstub;
+};
+
+#endif /* AHL4A_MPSC_H */
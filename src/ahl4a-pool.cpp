@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "ahl-interface.h"
+#include "ahl4a-pool.hpp"
+
+using namespace std;
+
+/* stream_id out of a stream_open reply: {"response":{"stream_id":N,...},...} */
+static int reply_stream_id(struct json_object* reply) {
+    struct json_object *response, *jid;
+    if (!json_object_object_get_ex(reply, "response", &response)) return -1;
+    if (!json_object_object_get_ex(response, "stream_id", &jid)) return -1;
+    return json_object_get_int(jid);
+}
+
+Audio4aPool::Audio4aPool()
+    : mdispatching(0), mnext_session(0), mnext_connection(0) {
+}
+
+Audio4aPool::~Audio4aPool() {
+}
+
+/**
+ * This function opens the shared connections
+ *
+ * #### Parameters
+ * - port        [in] : This argument should be specified to the port number to be used for websocket
+ * - token       [in] : This argument should be specified to the token to be used for websocket
+ * - connections [in] : Number of websockets shared by all sessions
+ *
+ * #### Return
+ * Returns 0 on success or -1 when a connection could not be made.
+ *
+ */
+int Audio4aPool::init(int port, const string& token, size_t connections) {
+    if (connections == 0 || !mconnections.empty()) return -1;
+
+    mconnections.resize(connections);
+    for (size_t i = 0; i < connections; i++) {
+        WsClientAudio4a* client = new WsClientAudio4a();
+        mconnections[i].client.reset(client);
+        if (client->init(port, token) != 0) {
+            mconnections.clear();
+            return -1;
+        }
+        client->set_stream_state_handler([this, i](const StreamStateEvent& ev) {
+            on_stream_state(i, ev);
+        });
+        client->set_endpoint_volume_handler([this](const EndpointVolumeEvent& ev) {
+            for_each_session(AHL_ENDPOINT_VOLUME_EVENT, [&ev](Session* s) {
+                if (s->mendpoint_volume_handler) s->mendpoint_volume_handler(ev);
+            });
+        });
+        client->set_endpoint_property_handler([this](const EndpointPropertyEvent& ev) {
+            for_each_session(AHL_ENDPOINT_PROPERTY_EVENT, [&ev](Session* s) {
+                if (s->mendpoint_property_handler) s->mendpoint_property_handler(ev);
+            });
+        });
+        client->set_post_action_handler([this](const PostActionEvent& ev) {
+            for_each_session(AHL_POST_ACTION_EVENT, [&ev](Session* s) {
+                if (s->mpost_action_handler) s->mpost_action_handler(ev);
+            });
+        });
+        client->set_reconnect_handler([this, i](const vector<WsClientAudio4a::StreamRemap>& streams) {
+            on_reconnect(i, streams);
+        });
+    }
+    return 0;
+}
+
+/**
+ * This function enables automatic reconnection of every shared connection
+ *
+ * #### Note
+ * See WsClientAudio4a::enable_reconnect(), reopened streams stay with their session
+ * and each session gets its own part of the stream ID mapping.
+ */
+void Audio4aPool::enable_reconnect(bool enable, uint64_t min_backoff_us, uint64_t max_backoff_us) {
+    for (Connection& c : mconnections) {
+        c.client->enable_reconnect(enable, min_backoff_us, max_backoff_us);
+    }
+}
+
+/**
+ * This function creates a logical client session
+ *
+ * #### Return
+ * - Returns the session, owned by the pool until close_session().
+ *
+ */
+Audio4aPool::Session* Audio4aPool::open_session() {
+    uint32_t id = ++mnext_session;
+    Session* s = new Session(this, id);
+    msessions[id].reset(s);
+    msession_list.push_back(s);
+    return s;
+}
+
+/**
+ * This function closes a session, its streams and its subscriptions
+ *
+ * #### Parameters
+ * - session [in] : session returned by open_session(), invalid after this call
+ *
+ * #### Note
+ * May be called from the handlers of the session itself.
+ */
+void Audio4aPool::close_session(Session* session) {
+    if (!session || session->mclosed) return;
+    session->mclosed = true;
+
+    for (auto& it : session->mstreams) {
+        Connection& c = mconnections[it.second];
+        c.owners.erase(it.first);
+        c.client->stream_close(it.first, [](int, json_object*) {});
+    }
+    session->mstreams.clear();
+    for (const string& ev : session->msubscriptions) {
+        release_event(ev);
+    }
+    session->msubscriptions.clear();
+
+    if (mdispatching == 0) {
+        purge_sessions();
+    }
+}
+
+size_t Audio4aPool::pending_calls() const {
+    size_t n = 0;
+    for (const Connection& c : mconnections) {
+        n += c.client->pending_calls();
+    }
+    return n;
+}
+
+/* least calls in flight among live connections, round robin on ties */
+size_t Audio4aPool::pick_connection() {
+    size_t n = mconnections.size();
+    size_t best = mnext_connection % n;
+    size_t best_load = SIZE_MAX;
+    for (size_t k = 0; k < n; k++) {
+        size_t i = (mnext_connection + k) % n;
+        WsClientAudio4a* client = mconnections[i].client.get();
+        if (!client->is_connected()) continue;
+        size_t load = client->pending_calls();
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    mnext_connection = (best + 1) % n;
+    return best;
+}
+
+Audio4aPool::Session* Audio4aPool::session(uint32_t id) {
+    auto it = msessions.find(id);
+    return (it == msessions.end() || it->second->mclosed) ? nullptr : it->second.get();
+}
+
+/* sessions subscribed to event_name, or all of them when empty; closing one from its handler is safe */
+template <class F>
+void Audio4aPool::for_each_session(string_view event_name, F&& f) {
+    mdispatching++;
+    for (size_t i = 0; i < msession_list.size(); i++) {
+        Session* s = msession_list[i];
+        if (s->mclosed) continue;
+        if (!event_name.empty() && s->msubscriptions.find(event_name) == s->msubscriptions.end()) continue;
+        f(s);
+    }
+    if (--mdispatching == 0) {
+        purge_sessions();
+    }
+}
+
+void Audio4aPool::purge_sessions() {
+    auto end = remove_if(msession_list.begin(), msession_list.end(), [](Session* s) { return s->mclosed; });
+    if (end == msession_list.end()) return;
+    for (auto it = end; it != msession_list.end(); ++it) {
+        msessions.erase((*it)->mid);
+    }
+    msession_list.erase(end, msession_list.end());
+}
+
+/* one subscription on the first connection serves every session, -1 only while it is disconnected */
+int Audio4aPool::retain_event(const string& event_name) {
+    if (mconnections.empty()) return -1;
+    int& refs = msubscriptions[event_name];
+    if (refs == 0 && mconnections[0].client->subscribe(event_name) != 0) {
+        msubscriptions.erase(event_name);
+        return -1;
+    }
+    refs++;
+    return 0;
+}
+
+void Audio4aPool::release_event(const string& event_name) {
+    auto it = msubscriptions.find(event_name);
+    if (it == msubscriptions.end()) return;
+    if (--it->second == 0) {
+        msubscriptions.erase(it);
+        mconnections[0].client->unsubscribe(event_name);
+    }
+}
+
+void Audio4aPool::on_stream_state(size_t conn, const StreamStateEvent& ev) {
+    Connection& c = mconnections[conn];
+    auto it = c.owners.find(ev.stream_id);
+    if (it == c.owners.end()) {
+        return;
+    }
+    Session* s = session(it->second);
+    if (s && s->mstream_state_handler) {
+        mdispatching++;
+        s->mstream_state_handler(ev);
+        if (--mdispatching == 0) {
+            purge_sessions();
+        }
+    }
+}
+
+void Audio4aPool::on_reconnect(size_t conn, const vector<WsClientAudio4a::StreamRemap>& streams) {
+    Connection& c = mconnections[conn];
+    map<uint32_t, vector<WsClientAudio4a::StreamRemap>> remaps;
+
+    for (const WsClientAudio4a::StreamRemap& r : streams) {
+        auto it = c.owners.find(r.old_stream_id);
+        if (it == c.owners.end()) continue;
+        uint32_t id = it->second;
+        c.owners.erase(it);
+        Session* s = session(id);
+        if (!s) continue;
+        s->mstreams.erase(r.old_stream_id);
+        if (r.new_stream_id >= 0) {
+            s->mstreams[r.new_stream_id] = conn;
+            c.owners[r.new_stream_id] = id;
+        }
+        remaps[id].push_back(r);
+    }
+    mdispatching++;
+    for (auto& it : remaps) {
+        Session* s = session(it.first);
+        if (s && s->monReconnect) s->monReconnect(it.second);
+    }
+    if (--mdispatching == 0) {
+        purge_sessions();
+    }
+}
+
+/**
+ * This function opens a stream on the least loaded connection
+ *
+ * #### Note
+ * The stream stays on that connection for its whole life.
+ */
+Audio4aPool::RequestHandle Audio4aPool::Session::stream_open(const string& audioRole, EndPointType4aT endPointType, const int endpointID, reply_fun on_reply) {
+    if (mclosed || mpool->mconnections.empty()) return WsClientAudio4a::InvalidRequest;
+
+    Audio4aPool* pool = mpool;
+    uint32_t id = mid;
+    size_t conn = pool->pick_connection();
+    return pool->mconnections[conn].client->stream_open(audioRole, endPointType, endpointID,
+        [pool, id, conn, on_reply](int status, json_object* reply) {
+            int stream_id = (status == WsClientAudio4a::Reply_Ok) ? reply_stream_id(reply) : -1;
+            if (stream_id >= 0) {
+                Connection& c = pool->mconnections[conn];
+                Session* s = pool->session(id);
+                if (s) {
+                    s->mstreams[stream_id] = conn;
+                    c.owners[stream_id] = id;
+                } else {
+                    /* session closed meanwhile */
+                    c.client->stream_close(stream_id, [](int, json_object*) {});
+                }
+            }
+            if (on_reply) on_reply(status, reply);
+        });
+}
+
+Audio4aPool::RequestHandle Audio4aPool::Session::stream_close(int streamID, reply_fun on_reply) {
+    auto it = mstreams.find(streamID);
+    if (mclosed || it == mstreams.end()) return WsClientAudio4a::InvalidRequest;
+
+    Connection& c = mpool->mconnections[it->second];
+    mstreams.erase(it);
+    c.owners.erase(streamID);
+    return c.client->stream_close(streamID, std::move(on_reply));
+}
+
+Audio4aPool::RequestHandle Audio4aPool::Session::set_stream_state(int streamID, const string& state, const bool mute, reply_fun on_reply) {
+    auto it = mstreams.find(streamID);
+    if (mclosed || it == mstreams.end()) return WsClientAudio4a::InvalidRequest;
+
+    return mpool->mconnections[it->second].client->set_stream_state(streamID, state, mute, std::move(on_reply));
+}
+
+/**
+ * This function calls any verb on the least loaded connection
+ *
+ * #### Note
+ * Use the stream functions for calls about a stream, they go to the connection owning it.
+ */
+Audio4aPool::RequestHandle Audio4aPool::Session::call(Audio4aVerbT verb, struct json_object* arg, reply_fun on_reply) {
+    if (mclosed || mpool->mconnections.empty()) {
+        json_object_put(arg);
+        return WsClientAudio4a::InvalidRequest;
+    }
+    return mpool->mconnections[mpool->pick_connection()].client->call(verb, arg, std::move(on_reply));
+}
+
+Audio4aPool::RequestHandle Audio4aPool::Session::call_raw(Audio4aVerbT verb, string_view args, WsClientAudio4a::raw_reply_fun on_reply) {
+    if (mclosed || mpool->mconnections.empty()) {
+        return WsClientAudio4a::InvalidRequest;
+    }
+    return mpool->mconnections[mpool->pick_connection()].client->call_raw(verb, args, std::move(on_reply));
+}
+
+int Audio4aPool::Session::subscribe(const string& event_name) {
+    if (mclosed) return -1;
+    if (msubscriptions.count(event_name)) return 0;
+    if (mpool->retain_event(event_name) != 0) return -1;
+    msubscriptions.insert(event_name);
+    return 0;
+}
+
+int Audio4aPool::Session::unsubscribe(const string& event_name) {
+    auto it = msubscriptions.find(event_name);
+    if (it == msubscriptions.end()) return -1;
+    msubscriptions.erase(it);
+    mpool->release_event(event_name);
+    return 0;
+}
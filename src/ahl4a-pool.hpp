@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_POOL_H
+#define AHL4A_POOL_H
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "wsclient-audio4a.hpp"
+
+/*
+ * Shares a few ahl4a connections among many logical client sessions, for
+ * gateway processes serving several HMI apps.
+ *
+ * Streams are sharded: stream_open goes to the connection with the fewest
+ * calls in flight and the stream then stays on it, since audio-4a keeps
+ * streams per websocket. Replies come back to their own handler, stream state
+ * events to the session owning the stream, and volume/property/post-action
+ * events to every session that subscribed to them. Only one asyncSetSourceState
+ * subscription and one handshake is made per connection, not per app.
+ *
+ * All connections share the sd_event loop of the thread calling init().
+ */
+class Audio4aPool
+{
+public:
+    using RequestHandle = WsClientAudio4a::RequestHandle;
+    using reply_fun = WsClientAudio4a::reply_fun;
+
+    class Session
+    {
+    public:
+        Session(const Session &) = delete;
+        Session &operator=(const Session &) = delete;
+
+        /* Same as WsClientAudio4a, handles are those of the connection serving the call */
+        RequestHandle stream_open(const std::string& audioRole, EndPointType4aT endPointType, const int endpointID, reply_fun on_reply);
+        RequestHandle stream_close(int streamID, reply_fun on_reply);
+        RequestHandle set_stream_state(int streamID, const std::string& state, const bool mute, reply_fun on_reply);
+        RequestHandle call(Audio4aVerbT verb, struct json_object* arg, reply_fun on_reply);
+        RequestHandle call_raw(Audio4aVerbT verb, std::string_view args, WsClientAudio4a::raw_reply_fun on_reply);
+
+        int subscribe(const std::string& event_name);
+        int unsubscribe(const std::string& event_name);
+        void set_stream_state_handler(WsClientAudio4a::stream_state_fun f) { mstream_state_handler = std::move(f); }
+        void set_endpoint_volume_handler(WsClientAudio4a::endpoint_volume_fun f) { mendpoint_volume_handler = std::move(f); }
+        void set_endpoint_property_handler(WsClientAudio4a::endpoint_property_fun f) { mendpoint_property_handler = std::move(f); }
+        void set_post_action_handler(WsClientAudio4a::post_action_fun f) { mpost_action_handler = std::move(f); }
+        /* streams of this session reopened after a reconnection, see Audio4aPool::enable_reconnect() */
+        void set_reconnect_handler(WsClientAudio4a::reconnect_fun f) { monReconnect = std::move(f); }
+
+        size_t streams() const { return mstreams.size(); }
+
+    private:
+        friend class Audio4aPool;
+        Session(Audio4aPool* pool, uint32_t id) : mpool(pool), mid(id) {}
+
+        Audio4aPool* mpool;
+        uint32_t mid;
+        bool mclosed = false;
+        std::unordered_map<int, size_t> mstreams;  /* stream id -> connection */
+        std::set<std::string, std::less<>> msubscriptions;
+        WsClientAudio4a::stream_state_fun mstream_state_handler;
+        WsClientAudio4a::endpoint_volume_fun mendpoint_volume_handler;
+        WsClientAudio4a::endpoint_property_fun mendpoint_property_handler;
+        WsClientAudio4a::post_action_fun mpost_action_handler;
+        WsClientAudio4a::reconnect_fun monReconnect;
+    };
+
+    Audio4aPool();
+    ~Audio4aPool();
+    Audio4aPool(const Audio4aPool &) = delete;
+    Audio4aPool &operator=(const Audio4aPool &) = delete;
+
+    int init(int port, const std::string& token, size_t connections);
+    void enable_reconnect(bool enable, uint64_t min_backoff_us = 10000, uint64_t max_backoff_us = 1000000);
+
+    Session* open_session();
+    void close_session(Session* session);
+
+    size_t connections() const { return mconnections.size(); }
+    size_t sessions() const { return msession_list.size(); }
+    size_t pending_calls() const;
+
+private:
+    struct Connection {
+        std::unique_ptr<WsClientAudio4a> client;
+        std::unordered_map<int, uint32_t> owners;   /* stream id -> session id */
+    };
+
+    size_t pick_connection();
+    Session* session(uint32_t id);
+    template <class F> void for_each_session(std::string_view event_name, F&& f);
+    void purge_sessions();
+    int retain_event(const std::string& event_name);
+    void release_event(const std::string& event_name);
+    void on_stream_state(size_t conn, const StreamStateEvent& ev);
+    void on_reconnect(size_t conn, const std::vector<WsClientAudio4a::StreamRemap>& streams);
+
+    std::vector<Connection> mconnections;
+    std::unordered_map<uint32_t, std::unique_ptr<Session>> msessions;
+    std::vector<Session*> msession_list;            /* dispatch order, closed ones removed outside dispatch */
+    int mdispatching;
+    std::map<std::string, int> msubscriptions;     /* event -> sessions subscribed */
+    uint32_t mnext_session;
+    size_t mnext_connection;
+};
+
+#endif /* AHL4A_POOL_H */
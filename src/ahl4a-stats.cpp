@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ahl4a-stats.hpp"
+
+int LatencyHistogram::bucket(uint64_t value_ns) {
+    if (value_ns < (uint64_t)SubBuckets)
+        return (int)value_ns;
+    int msb = 63 - __builtin_clzll(value_ns);
+    int shift = msb - SubBits;
+    if (shift > MaxShift)
+        return Buckets - 1;
+    int sub = (int)((value_ns >> shift) & (SubBuckets - 1));
+    return (shift + 1) * SubBuckets + sub;
+}
+
+/* middle of the bucket range */
+uint64_t LatencyHistogram::bucket_value(int bucket) {
+    if (bucket < SubBuckets)
+        return (uint64_t)bucket;
+    int shift = bucket / SubBuckets - 1;
+    uint64_t low = (uint64_t)(SubBuckets + bucket % SubBuckets) << shift;
+    return low + ((uint64_t)1 << shift) / 2;
+}
+
+void LatencyHistogram::snapshot(Snapshot* out, bool reset) {
+    for (int i = 0; i < Buckets; i++)
+        out->counts[i] = reset ? counts[i].exchange(0, std::memory_order_relaxed)
+                               : counts[i].load(std::memory_order_relaxed);
+    out->count = reset ? total.exchange(0, std::memory_order_relaxed) : total.load(std::memory_order_relaxed);
+    out->sum_ns = reset ? sum.exchange(0, std::memory_order_relaxed) : sum.load(std::memory_order_relaxed);
+    out->max_ns = reset ? max.exchange(0, std::memory_order_relaxed) : max.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < Buckets; i++)
+        counts[i].store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double p) const {
+    uint64_t n = 0;
+    for (int i = 0; i < Buckets; i++)
+        n += counts[i];
+    if (n == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * (double)(n - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < Buckets; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            uint64_t v = bucket_value(i);
+            return (v > max_ns && max_ns) ? max_ns : v;
+        }
+    }
+    return max_ns;
+}
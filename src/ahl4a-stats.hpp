@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_STATS_H
+#define AHL4A_STATS_H
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * HDR-style log-linear latency histogram in nanoseconds.
+ * Each power of two is split in 16 linear buckets (~6% precision) up to 2^40 ns,
+ * larger values land in the last bucket. Recording is one relaxed atomic add,
+ * so any thread may record while another takes a snapshot.
+ */
+class LatencyHistogram
+{
+public:
+    static const int SubBits = 4;
+    static const int SubBuckets = 1 << SubBits;
+    static const int MaxShift = 36;
+    static const int Buckets = (MaxShift + 2) * SubBuckets;
+
+    /* plain copy, for percentiles and dumps */
+    struct Snapshot {
+        uint64_t counts[Buckets];
+        uint64_t count;
+        uint64_t sum_ns;
+        uint64_t max_ns;
+
+        uint64_t percentile(double p) const;
+        uint64_t mean() const { return count ? sum_ns / count : 0; }
+    };
+
+    LatencyHistogram() { reset(); }
+
+    void record(uint64_t value_ns) {
+        counts[bucket(value_ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value_ns, std::memory_order_relaxed);
+        uint64_t m = max.load(std::memory_order_relaxed);
+        while (value_ns > m && !max.compare_exchange_weak(m, value_ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    /* copy, and clear when reset is set */
+    void snapshot(Snapshot* out, bool reset);
+    void reset();
+
+    static int bucket(uint64_t value_ns);
+    static uint64_t bucket_value(int bucket);
+
+private:
+    std::atomic<uint64_t> counts[Buckets];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+#endif /* AHL4A_STATS_H */
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_TIMER_WHEEL_H
+#define AHL4A_TIMER_WHEEL_H
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Intrusive hierarchical timer wheel.
+ * Levels of 64 slots, level L holds the timers due within 64^(L+1) ticks of
+ * now, farther ones wait in an overflow list until they fit. add() and remove()
+ * are O(1), a timer moves down at most once per level while the wheel turns,
+ * advance() skips the ticks where no slot is due. next_due() is the earliest
+ * due tick itself, not the next cascade. T needs 'T* timer_prev', 'T* timer_next',
+ * 'uint64_t timer_due' and 'int timer_slot' (-1 when not armed) members.
+ * Nodes are owned by the caller, nothing is allocated.
+ */
+template <class T>
+class TimerWheel
+{
+public:
+    static const int Bits = 6;
+    static const int Slots = 1 << Bits;
+    static const int Levels = 4;
+    static const uint64_t Range = (uint64_t)1 << (Bits * Levels);
+    static const uint64_t Never = UINT64_MAX;
+
+    TimerWheel() : mnow(0), mcount(0), moverflow(nullptr), mearliest(Never), mearliest_known(true) {
+        for (int l = 0; l < Levels; l++) {
+            mbitmap[l] = 0;
+            for (int s = 0; s < Slots; s++) mslots[l][s] = nullptr;
+        }
+    }
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    bool empty() const { return mcount == 0; }
+    size_t size() const { return mcount; }
+
+    /* due is an absolute tick, one already past expires on the next advance() */
+    void add(T* t, uint64_t due, uint64_t now) {
+        if (t->timer_slot >= 0) remove(t);
+        if (mcount == 0 && now > mnow) mnow = now;
+        if (due <= mnow) due = mnow + 1;
+        t->timer_due = due;
+        place(t);
+        mcount++;
+        if (mearliest_known && due < mearliest) mearliest = due;
+    }
+
+    void remove(T* t) {
+        if (t->timer_slot < 0) return;
+        unlink(t);
+        mcount--;
+        if (t->timer_due == mearliest) mearliest_known = false;
+    }
+
+    /* earliest due tick, Never when empty */
+    uint64_t next_due() const {
+        if (mcount == 0) return Never;
+        if (mearliest_known) return mearliest;
+        /* level 0 slots hold one tick each, above only the first slot in time of a level is looked into */
+        uint64_t next = Never;
+        if (mbitmap[0]) {
+            next = mnow + 1 + (uint64_t)first_slot(0);
+        }
+        for (int l = 1; l < Levels; l++) {
+            if (!mbitmap[l]) continue;
+            int s = (int)((((mnow >> (Bits * l)) + 1) + (uint64_t)first_slot(l)) & (Slots - 1));
+            next = earliest(mslots[l][s], next);
+        }
+        next = earliest(moverflow, next);
+        mearliest = next;
+        mearliest_known = true;
+        return next;
+    }
+
+    /* expire(T*) is called for each timer due up to now, once unlinked; it may add or remove timers */
+    template <class F>
+    void advance(uint64_t now, F&& expire) {
+        while (mnow < now) {
+            uint64_t next = next_work();
+            if (next > now) {
+                mnow = now;
+                break;
+            }
+            mnow = next;
+            if (moverflow && next == overflow_work()) {
+                unoverflow();
+            }
+            for (int l = Levels - 1; l > 0; l--) {
+                int shift = Bits * l;
+                if ((mnow & ((((uint64_t)1) << shift) - 1)) == 0) {
+                    cascade(l, (int)((mnow >> shift) & (Slots - 1)));
+                }
+            }
+            int s = (int)(mnow & (Slots - 1));
+            while (T* t = mslots[0][s]) {
+                unlink(t);
+                mcount--;
+                mearliest_known = false;
+                expire(t);
+            }
+        }
+    }
+
+private:
+    static const int Overflow = Levels * Slots;    /* timer_slot of the overflow list */
+
+    static uint64_t rotr(uint64_t v, int n) {
+        return n ? (v >> n) | (v << (64 - n)) : v;
+    }
+
+    static uint64_t earliest(const T* t, uint64_t next) {
+        for (; t; t = t->timer_next) {
+            if (t->timer_due < next) next = t->timer_due;
+        }
+        return next;
+    }
+
+    /* set slots of level l counted from the one after now, in time order */
+    int first_slot(int l) const {
+        int shift = (int)(((mnow >> (Bits * l)) + 1) & (Slots - 1));
+        return __builtin_ctzll(rotr(mbitmap[l], shift));
+    }
+
+    /* tick at which advance() has work: an expiry, a cascade or an overflow timer fitting in */
+    uint64_t next_work() const {
+        uint64_t next = Never;
+        if (mbitmap[0]) {
+            next = mnow + 1 + (uint64_t)first_slot(0);
+        }
+        for (int l = 1; l < Levels; l++) {
+            if (!mbitmap[l]) continue;
+            int shift = Bits * l;
+            uint64_t start = ((mnow >> shift) + 1 + (uint64_t)first_slot(l)) << shift;
+            if (start < next) next = start;
+        }
+        if (moverflow) {
+            uint64_t fits = overflow_work();
+            if (fits < next) next = fits;
+        }
+        return next;
+    }
+
+    uint64_t overflow_work() const {
+        return earliest(moverflow, Never) - (Range - 1);
+    }
+
+    /* overflow timers now within Range go to the wheel */
+    void unoverflow() {
+        T* t = moverflow;
+        moverflow = nullptr;
+        while (t) {
+            T* next = t->timer_next;
+            place(t);
+            t = next;
+        }
+    }
+
+    void place(T* t) {
+        uint64_t delta = t->timer_due - mnow;
+        if (delta >= Range) {
+            t->timer_prev = nullptr;
+            t->timer_next = moverflow;
+            if (moverflow) moverflow->timer_prev = t;
+            moverflow = t;
+            t->timer_slot = Overflow;
+            return;
+        }
+        int l = 0;
+        while (l < Levels - 1 && delta >= ((uint64_t)1 << (Bits * (l + 1)))) l++;
+        int s = (int)((t->timer_due >> (Bits * l)) & (Slots - 1));
+        T*& head = mslots[l][s];
+        t->timer_prev = nullptr;
+        t->timer_next = head;
+        if (head) head->timer_prev = t;
+        head = t;
+        t->timer_slot = l * Slots + s;
+        mbitmap[l] |= (uint64_t)1 << s;
+    }
+
+    void unlink(T* t) {
+        if (t->timer_slot == Overflow) {
+            if (t->timer_prev) t->timer_prev->timer_next = t->timer_next;
+            else moverflow = t->timer_next;
+            if (t->timer_next) t->timer_next->timer_prev = t->timer_prev;
+            t->timer_prev = t->timer_next = nullptr;
+            t->timer_slot = -1;
+            return;
+        }
+        int l = t->timer_slot / Slots;
+        int s = t->timer_slot % Slots;
+        if (t->timer_prev) t->timer_prev->timer_next = t->timer_next;
+        else mslots[l][s] = t->timer_next;
+        if (t->timer_next) t->timer_next->timer_prev = t->timer_prev;
+        if (!mslots[l][s]) mbitmap[l] &= ~((uint64_t)1 << s);
+        t->timer_prev = t->timer_next = nullptr;
+        t->timer_slot = -1;
+    }
+
+    /* the slot of a higher level whose range starts now goes one level down or more */
+    void cascade(int l, int s) {
+        T* t = mslots[l][s];
+        mslots[l][s] = nullptr;
+        mbitmap[l] &= ~((uint64_t)1 << s);
+        while (t) {
+            T* next = t->timer_next;
+            place(t);
+            t = next;
+        }
+    }
+
+    uint64_t mnow;
+    size_t mcount;
+    T* moverflow;
+    mutable uint64_t mearliest;     /* cache of next_due(), valid while mearliest_known */
+    mutable bool mearliest_known;
+    uint64_t mbitmap[Levels];
+    T* mslots[Levels][Slots];
+};
+
+#endif /* AHL4A_TIMER_WHEEL_H */
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <random>
+#include "ahl4a-transport.hpp"
+
+using namespace std;
+
+namespace ahl4a_transport {
+
+static const char UnixScheme[] = "unix:";
+static const size_t MaxResponse = 4096;
+
+static int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* 1 when ready, 0 on timeout, -1 on error */
+static int wait_fd(int fd, short events, int64_t deadline_ms) {
+    struct pollfd pfd = {fd, events, 0};
+    for (;;) {
+        int64_t left = deadline_ms - now_ms();
+        if (left <= 0) return 0;
+        int ret = poll(&pfd, 1, (int)left);
+        if (ret >= 0) return ret;
+        if (errno != EINTR) return -1;
+    }
+}
+
+static string base64(const unsigned char* data, size_t len) {
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string out;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        out += chars[(v >> 18) & 63];
+        out += chars[(v >> 12) & 63];
+        out += (i + 1 < len) ? chars[(v >> 6) & 63] : '=';
+        out += (i + 2 < len) ? chars[v & 63] : '=';
+    }
+    return out;
+}
+
+/* FIPS 180-4, only for Sec-WebSocket-Accept */
+static void sha1(const string& data, unsigned char digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    string msg = data;
+    uint64_t bits = (uint64_t)data.size() * 8;
+    msg.push_back((char)0x80);
+    while (msg.size() % 64 != 56) msg.push_back(0);
+    for (int i = 7; i >= 0; i--) msg.push_back((char)(bits >> (i * 8)));
+
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const unsigned char* p = (const unsigned char*)msg.data() + off + i * 4;
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            uint32_t v = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (v << 1) | (v >> 31);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 20; i++) digest[i] = (unsigned char)(h[i / 4] >> (24 - (i % 4) * 8));
+}
+
+/* RFC 6455 4.2.2: base64 of the SHA-1 of the key and the protocol GUID */
+static string accept_key(const string& key) {
+    unsigned char digest[20];
+    sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", digest);
+    return base64(digest, sizeof(digest));
+}
+
+/* value of a response header, case-insensitive name */
+static string_view header(string_view response, string_view name) {
+    size_t pos = response.find("\r\n");
+    while (pos != string_view::npos && pos + 2 < response.size()) {
+        size_t start = pos + 2;
+        size_t end = response.find("\r\n", start);
+        if (end == string_view::npos) break;
+        string_view line = response.substr(start, end - start);
+        if (line.size() > name.size() && line[name.size()] == ':' &&
+            strncasecmp(line.data(), name.data(), name.size()) == 0) {
+            string_view value = line.substr(name.size() + 1);
+            while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+            return value;
+        }
+        pos = end;
+    }
+    return string_view();
+}
+
+bool is_unix_uri(string_view uri) {
+    return uri.compare(0, sizeof(UnixScheme) - 1, UnixScheme) == 0;
+}
+
+int connect_unix(string_view uri, string* target) {
+    struct sockaddr_un addr;
+    if (!is_unix_uri(uri)) {
+        errno = EINVAL;
+        return -1;
+    }
+    string_view rest = uri.substr(sizeof(UnixScheme) - 1);
+    size_t query = rest.find('?');
+    string_view path = rest.substr(0, query);
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    target->assign("/api");
+    if (query != string_view::npos) {
+        target->append(rest.substr(query));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+        /* abstract socket, no trailing NUL in its name */
+        addr.sun_path[0] = '\0';
+    }
+    socklen_t len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path.size() + (path[0] == '@' ? 0 : 1));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, len) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int upgrade(int fd, const string& target, int timeout_ms) {
+    int64_t deadline = now_ms() + timeout_ms;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+
+    unsigned char nonce[16];
+    random_device rd;
+    for (size_t i = 0; i < sizeof(nonce); i++) nonce[i] = (unsigned char)rd();
+    string key = base64(nonce, sizeof(nonce));
+    string request = "GET " + target + " HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "Sec-WebSocket-Key: " + key + "\r\n"
+                     "Sec-WebSocket-Protocol: x-afb-ws-json1\r\n"
+                     "Content-Length: 0\r\n"
+                     "\r\n";
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = ::send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            if (wait_fd(fd, POLLOUT, deadline) <= 0) return -1;
+        } else {
+            return -1;
+        }
+    }
+
+    /*
+     * Headers are read as they come, only the part holding their end is peeked so
+     * that the frames behind them stay for afb-wsj1. Bytes left unread would keep
+     * the socket readable, poll() would not wait.
+     */
+    char buf[MaxResponse];
+    size_t have = 0;
+    size_t end = 0;
+    for (;;) {
+        ssize_t n = recv(fd, buf + have, sizeof(buf) - have, MSG_PEEK);
+        if (n > 0) {
+            /* the end may straddle what was read and what is peeked */
+            size_t pos = string_view(buf, have + (size_t)n).find("\r\n\r\n", have > 3 ? have - 3 : 0);
+            if (pos != string_view::npos) {
+                end = pos + 4;
+                break;
+            }
+            if (recv(fd, buf + have, (size_t)n, 0) != n) return -1;
+            have += (size_t)n;
+            if (have == sizeof(buf)) return -1;
+        } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            return -1;
+        } else if (errno == EINTR) {
+            continue;
+        }
+        if (wait_fd(fd, POLLIN, deadline) <= 0) return -1;
+    }
+    if (recv(fd, buf + have, end - have, 0) != (ssize_t)(end - have)) {
+        return -1;
+    }
+
+    string_view response(buf, end);
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0 ||
+        header(response, "Sec-WebSocket-Accept") != accept_key(key) ||
+        header(response, "Sec-WebSocket-Protocol") != "x-afb-ws-json1") {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+}
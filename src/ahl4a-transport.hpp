@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_TRANSPORT_H
+#define AHL4A_TRANSPORT_H
+#include <string>
+#include <string_view>
+
+/*
+ * Websocket transports besides the TCP one of afb_ws_client_connect_wsj1().
+ * The HTTP upgrade to x-afb-ws-json1 is done here on a connected stream
+ * socket, afb_wsj1_create() then runs the usual wsj1 framing over it, as
+ * afb_ws_client_connect_wsj1() does once its own TCP socket is upgraded.
+ */
+namespace ahl4a_transport {
+    static const int UpgradeTimeoutMs = 5000;
+    /* on reconnection the upgrade blocks the event loop, a local binder answers well within it */
+    static const int ReconnectUpgradeTimeoutMs = 200;
+
+    /* "unix:/path/to/socket[?query]", "unix:@name[?query]" for the abstract namespace */
+    bool is_unix_uri(std::string_view uri);
+
+    /* connected socket or -1 with errno set, target gets the HTTP request target "/api[?query]" */
+    int connect_unix(std::string_view uri, std::string* target);
+
+    /* blocking upgrade of a connected socket, left non-blocking; 0 on success, -1 otherwise.
+       The Sec-WebSocket-Accept of the reply is checked against the key sent. */
+    int upgrade(int fd, const std::string& target, int timeout_ms);
+}
+
+#endif /* AHL4A_TRANSPORT_H */
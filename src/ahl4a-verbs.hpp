@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AHL4A_VERBS_H
+#define AHL4A_VERBS_H
+#include <string_view>
+
+/* Verbs of the audio-4a high level API ("ahl4a") */
+typedef enum {
+  AUDIO4A_VERB_UNKNOWN = -1,
+  AUDIO4A_VERB_STREAM_OPEN,
+  AUDIO4A_VERB_STREAM_CLOSE,
+  AUDIO4A_VERB_GET_ENDPOINTS,
+  AUDIO4A_VERB_SET_STREAM_STATE,
+  AUDIO4A_VERB_GET_STREAM_INFO,
+  AUDIO4A_VERB_VOLUME,
+  AUDIO4A_VERB_GET_ENDPOINT_INFO,
+  AUDIO4A_VERB_PROPERTY,
+  AUDIO4A_VERB_EVENT_SUBSCRIPTION,
+  AUDIO4A_VERB_COUNT
+} Audio4aVerbT;
+
+/* Wire names, indexed by Audio4aVerbT */
+constexpr const char* audio4a_verb_names[AUDIO4A_VERB_COUNT] = {
+    "stream_open",
+    "stream_close",
+    "get_endpoints",
+    "set_stream_state",
+    "get_stream_info",
+    "volume",
+    "get_endpoint_info",
+    "property",
+    "event_subscription",
+};
+
+constexpr const char* audio4a_verb_name(Audio4aVerbT verb) {
+    return (verb > AUDIO4A_VERB_UNKNOWN && verb < AUDIO4A_VERB_COUNT) ? audio4a_verb_names[verb] : nullptr;
+}
+
+/*
+ * Every verb name has a distinct length, so the length is a perfect hash:
+ * one switch and at most one compare, no allocation.
+ */
+constexpr Audio4aVerbT audio4a_verb_lookup(std::string_view name) {
+    Audio4aVerbT candidate = AUDIO4A_VERB_UNKNOWN;
+    switch (name.size()) {
+        case 11: candidate = AUDIO4A_VERB_STREAM_OPEN; break;
+        case 12: candidate = AUDIO4A_VERB_STREAM_CLOSE; break;
+        case 13: candidate = AUDIO4A_VERB_GET_ENDPOINTS; break;
+        case 16: candidate = AUDIO4A_VERB_SET_STREAM_STATE; break;
+        case 15: candidate = AUDIO4A_VERB_GET_STREAM_INFO; break;
+        case 6:  candidate = AUDIO4A_VERB_VOLUME; break;
+        case 17: candidate = AUDIO4A_VERB_GET_ENDPOINT_INFO; break;
+        case 8:  candidate = AUDIO4A_VERB_PROPERTY; break;
+        case 18: candidate = AUDIO4A_VERB_EVENT_SUBSCRIPTION; break;
+        default: return AUDIO4A_VERB_UNKNOWN;
+    }
+    return (name == audio4a_verb_names[candidate]) ? candidate : AUDIO4A_VERB_UNKNOWN;
+}
+
+/* the hash only holds while names keep distinct lengths, checked at build time */
+static_assert(audio4a_verb_lookup("stream_open") == AUDIO4A_VERB_STREAM_OPEN, "verb table");
+static_assert(audio4a_verb_lookup("stream_close") == AUDIO4A_VERB_STREAM_CLOSE, "verb table");
+static_assert(audio4a_verb_lookup("get_endpoints") == AUDIO4A_VERB_GET_ENDPOINTS, "verb table");
+static_assert(audio4a_verb_lookup("set_stream_state") == AUDIO4A_VERB_SET_STREAM_STATE, "verb table");
+static_assert(audio4a_verb_lookup("get_stream_info") == AUDIO4A_VERB_GET_STREAM_INFO, "verb table");
+static_assert(audio4a_verb_lookup("volume") == AUDIO4A_VERB_VOLUME, "verb table");
+static_assert(audio4a_verb_lookup("get_endpoint_info") == AUDIO4A_VERB_GET_ENDPOINT_INFO, "verb table");
+static_assert(audio4a_verb_lookup("property") == AUDIO4A_VERB_PROPERTY, "verb table");
+static_assert(audio4a_verb_lookup("event_subscription") == AUDIO4A_VERB_EVENT_SUBSCRIPTION, "verb table");
+static_assert(audio4a_verb_lookup("connect") == AUDIO4A_VERB_UNKNOWN, "verb table");
+
+#endif /* AHL4A_VERBS_H */
@@ -14,50 +14,46 @@
  * limitations under the License.
  */
 
-#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/socket.h>
-#include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <algorithm>
+#include <memory>
 #include "wrap-json.h"
 #include "ahl-interface.h"
 #include "wsclient-audio4a.hpp"
+#include "ahl4a-log.hpp"
+#include "ahl4a-json.hpp"
+#include "ahl4a-transport.hpp"
 
-#define ELOG(args,...) _ELOG(__FUNCTION__,__LINE__,args,##__VA_ARGS__)
-#ifdef DEBUGMODE
-#define DLOG(args,...) _DLOG(__FUNCTION__,__LINE__,args,##__VA_ARGS__)
-#else
-#define DLOG(args,...)
-#endif
-static void _DLOG(const char* func, const int line, const char* log, ...);
-static void _ELOG(const char* func, const int line, const char* log, ...);
+#define ELOG(args,...) AHL4A_LOG(ahl4a_log::Error, args, ##__VA_ARGS__)
+#define DLOG(args,...) AHL4A_LOG(ahl4a_log::Debug, args, ##__VA_ARGS__)
 
 using namespace std;
 
-static bool has_verb(const std::string& verb);
 static const char API[] = "ahl4a"; // audio-4a high level API
 
-static const std::vector<std::string> api_list{
-    std::string("stream_open"),
-    std::string("stream_close"),
-    std::string("get_endpoints"),
-    std::string("set_stream_state"),
-    std::string("get_stream_info"),
-    std::string("volume"),
-    std::string("get_endpoint_info"),
-    std::string("property"),
-    std::string("event_subscription"),
-    };
-
-static const std::vector<std::string> event_list{
-    std::string("asyncSetSourceState"),
-    std::string("newMainConnection"),
-    std::string("volumeChanged"),
-    std::string("removedMainConnection"),
-    std::string("sinkMuteStateChanged"),
-    std::string("mainConnectionStateChanged"),
-    std::string("setRoutingReady"),
-    std::string("setRoutingRundown"),
-    std::string("asyncConnect")};
+/* event names without the "ahl4a/" prefix, indexed by EventType_SM */
+static const char* const event_names[WsClientAudio4a::Event_Max] = {
+    NULL,
+    "asyncSetSourceState",
+    "newMainConnection",
+    "volumeChanged",
+    "removedMainConnection",
+    "sinkMuteStateChanged",
+    "mainConnectionStateChanged",
+    "setRoutingReady",
+    "setRoutingRundown",
+    "asyncConnect",
+    AHL_ENDPOINT_PROPERTY_EVENT,
+    AHL_ENDPOINT_VOLUME_EVENT,
+    AHL_POST_ACTION_EVENT,
+    AHL_STREAM_STATE_EVENT,
+};
 
 static void _on_hangup_static(void *closure, struct afb_wsj1 *wsj) {
     static_cast<WsClientAudio4a*> (closure)->on_hangup(NULL, wsj);
@@ -71,20 +67,193 @@ static void _on_event_static(void* closure, const char* event, struct afb_wsj1_m
     static_cast<WsClientAudio4a*> (closure)->on_event(NULL, event, msg);
 }
 
+static int _on_reconnect_timer_static(sd_event_source *source, uint64_t usec, void *closure) {
+    static_cast<WsClientAudio4a*> (closure)->on_reconnect_timer();
+    return 0;
+}
+
+static int _on_coalesce_timer_static(sd_event_source *source, uint64_t usec, void *closure) {
+    /* closure is the entry, it knows its owner */
+    WsClientAudio4a::on_coalesce_timer(closure);
+    return 0;
+}
+
+static int _on_deadline_timer_static(sd_event_source *source, uint64_t usec, void *closure) {
+    static_cast<WsClientAudio4a*> (closure)->on_deadline_timer();
+    return 0;
+}
+
+static int _on_subscription_flush_static(sd_event_source *source, void *closure) {
+    static_cast<WsClientAudio4a*> (closure)->on_subscription_flush();
+    return 0;
+}
+
+static int _on_evicted_static(sd_event_source *source, void *closure) {
+    static_cast<WsClientAudio4a*> (closure)->on_evicted();
+    return 0;
+}
+
+static int _on_io_wake_static(sd_event_source *source, int fd, uint32_t revents, void *closure) {
+    static_cast<WsClientAudio4a*> (closure)->on_io_wake();
+    return 0;
+}
+
 static void _on_reply_static(void *closure, struct afb_wsj1_msg *msg) {
-    static_cast<WsClientAudio4a*> (closure)->on_reply(NULL, msg);
+    static_cast<WsClientAudio4a::PendingCall*> (closure)->owner->on_reply(closure, msg);
+}
+
+static const uint32_t NO_PENDING = UINT32_MAX;
+
+static const char* endpoint_type_string(EndPointType4aT endPointType) {
+    switch (endPointType) {
+        case AUDIO4A_ENDPOINT_SINK:
+            return AHL_ENDPOINTTYPE_SINK;
+        case AUDIO4A_ENDPOINT_SOURCE:
+            return AHL_ENDPOINTTYPE_SOURCE;
+        default:
+            return NULL;
+    }
+}
+
+/* AHL_PROPERTY_* in WsClientAudio4a::StandardProperty order */
+static const char* const property_names[WsClientAudio4a::Property_Max] = {
+    AHL_PROPERTY_BALANCE,
+    AHL_PROPERTY_FADE,
+    AHL_PROPERTY_EQ_LOW,
+    AHL_PROPERTY_EQ_MID,
+    AHL_PROPERTY_EQ_HIGH
+};
+
+/* AHL_ROLE_* in WsClientAudio4a::RoleCount order, unknown roles are "none" */
+static const char* const role_names[WsClientAudio4a::RoleCount] = {
+    AHL_ROLE_WARNING,
+    AHL_ROLE_GUIDANCE,
+    AHL_ROLE_NOTIFICATION,
+    AHL_ROLE_COMMUNICATION,
+    AHL_ROLE_ENTERTAINMENT,
+    AHL_ROLE_SYSTEM,
+    AHL_ROLE_STARTUP,
+    AHL_ROLE_SHUTDOWN,
+    AHL_ROLE_NONE
+};
+static const int ROLE_NONE = WsClientAudio4a::RoleCount - 1;
+
+/* 0 goes first: alerts, then what the user waits for, media and unknown traffic last */
+static const int default_role_priority[WsClientAudio4a::RoleCount] = {0, 1, 3, 2, 5, 4, 3, 3, 6};
+
+static int role_index(string_view role) {
+    for (int i = 0; i < WsClientAudio4a::RoleCount; i++) {
+        if (role == role_names[i]) return i;
+    }
+    return ROLE_NONE;
+}
+
+/* verbs whose reply carries nothing but the status */
+static bool status_only(Audio4aVerbT verb) {
+    switch (verb) {
+        case AUDIO4A_VERB_SET_STREAM_STATE:
+        case AUDIO4A_VERB_STREAM_CLOSE:
+        case AUDIO4A_VERB_VOLUME:
+        case AUDIO4A_VERB_PROPERTY:
+        case AUDIO4A_VERB_EVENT_SUBSCRIPTION:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* request text of the calling thread, cleared and reused by every encoded request */
+static string& send_buffer() {
+    static thread_local string buf;
+    buf.clear();
+    return buf;
+}
+
+/* stream_id out of a stream_open reply: {"response":{"stream_id":N,...},"jtype":"afb-reply",...} */
+static int reply_stream_id(struct json_object* reply) {
+    struct json_object *response, *jid;
+    if (!json_object_object_get_ex(reply, "response", &response)) return -1;
+    if (!json_object_object_get_ex(response, "stream_id", &jid)) return -1;
+    return json_object_get_int(jid);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
 }
 
-WsClientAudio4a::WsClientAudio4a() {
+/* deadline wheel tick */
+static const uint64_t TICK_US = 1000;
+
+WsClientAudio4a::WsClientAudio4a()
+    : onEvent(nullptr), onReply(nullptr), onHangup(nullptr),
+      sp_websock(NULL), mstale_websock(NULL), mploop(NULL), mport(0), msubscription_flush(NULL), msubscriptions_refused(false),
+      msuppress_redundant(true), mquery_cache(true), mquery_ttl_us(0), mendpoint_events(false),
+      mcoalescing(false), mcoalesce_window_us(0),
+      mallocation_free(false), mprealloc_calls(0), mprealloc_streams(0), munchanged(NULL), munchanged_id(NULL),
+      mreconnect(false), mbackoff_min_us(0), mbackoff_max_us(0), mbackoff_us(0),
+      mreconnect_timer(NULL), mfd(-1), mconnected(false), mthreaded(false),
+      mstopping(false), mio_exited(false), mwake_armed(false), mwake_fd(-1), mwake_source(NULL),
+      mnext_ticket(0), mnext_listener(0),
+      mfree_pending(NO_PENDING), mnpending(0),
+      mdefault_timeout_us(0), mdeadline_timer(NULL), mdeadline_armed(TimerWheel<PendingCall>::Never),
+      msend_window(0), msend_window_bytes(0), mwire_bytes(0), mqueue_max_calls(SIZE_MAX), mqueue_max_bytes(SIZE_MAX),
+      mqueued_bytes(0), mnqueued(0), msend_ready(0), mpumping(false), mevicted_flush(NULL), mnevicted(0),
+      mrole_stats(new RoleCounters[RoleCount]), mlast_failure(Reply_Error), mblocked(false), mwould_block(0),
+      mverb_stats(new VerbCounters[AUDIO4A_VERB_COUNT]),
+      mbytes_sent(0), mbytes_received(0) {
+    for (int i = 0; i < Event_Max; i++) {
+        mevent_counts[i].store(0, memory_order_relaxed);
+    }
+    for (int i = 0; i < PriorityLevels; i++) {
+        msend_head[i] = msend_tail[i] = nullptr;
+    }
+    for (int i = 0; i < RoleCount; i++) {
+        mrole_priority[i] = default_role_priority[i];
+    }
 }
 
 WsClientAudio4a::~WsClientAudio4a() {
+    if (mio_thread.joinable()) {
+        mstopping.store(true, memory_order_release);
+        wake();
+        mio_thread.join();
+    }
+    if (mwake_fd >= 0) {
+        close(mwake_fd);
+    }
+    if (mreconnect_timer) {
+        sd_event_source_unref(mreconnect_timer);
+    }
+    if (mdeadline_timer) {
+        sd_event_source_unref(mdeadline_timer);
+    }
+    if (msubscription_flush) {
+        sd_event_source_unref(msubscription_flush);
+    }
+    if (mevicted_flush) {
+        sd_event_source_unref(mevicted_flush);
+    }
     if (mploop) {
         sd_event_unref(mploop);
     }
     if (sp_websock != NULL) {
         afb_wsj1_unref(sp_websock);
     }
+    if (mstale_websock != NULL) {
+        afb_wsj1_unref(mstale_websock);
+    }
+    clear_queries();
+    for (auto& it : mcoalesce) {
+        if (it.second.timer) sd_event_source_unref(it.second.timer);
+    }
+    if (munchanged) {
+        json_object_put(munchanged);
+    }
+    if (mfd >= 0) {
+        close(mfd);
+    }
 }
 
 /**
@@ -101,7 +270,6 @@ WsClientAudio4a::~WsClientAudio4a() {
  *
  */
 int WsClientAudio4a::init(int port, const string& token) {
-    int ret;
     if (port > 0 && token.size() > 0) {
         mport = port;
         mtoken = token;
@@ -109,6 +277,66 @@ int WsClientAudio4a::init(int port, const string& token) {
         ELOG("port and token should be > 0, Initial port and token uses.");
         return -1;
     }
+    return init("ws://localhost:" + to_string(port) + "/api?token=" + token);
+}
+
+/**
+ * This function is initialization function connecting to a websocket URI
+ *
+ * #### Parameters
+ * - uri [in] : "ws://host:port/api?token=..." or "unix:/path/to/socket?token=...",
+ *              "unix:@name?token=..." for a socket of the abstract namespace
+ *
+ * #### Return
+ * Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * With a unix: URI calls and events go through an AF_UNIX socket instead of the
+ * loopback TCP stack, the binder must listen on it (afb-daemon --ws-server=unix:...
+ * or a websocket proxy). Framing is the same x-afb-ws-json1 as over TCP and
+ * reconnection connects to the same URI again. The HTTP upgrade is blocking, on
+ * reconnection it runs on the event loop and holds it for 200 ms at most.
+ */
+int WsClientAudio4a::init(const string& uri) {
+    if (uri.empty()) {
+        ELOG("uri should not be empty");
+        return -1;
+    }
+    muri = uri;
+    return init_loop();
+}
+
+/**
+ * This function is initialization function using an already connected socket
+ *
+ * #### Parameters
+ * - fd    [in] : stream socket connected to the binder, owned by the client from now on
+ * - token [in] : This argument should be specified to the token to be used for websocket
+ *
+ * #### Return
+ * Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * For sockets handed over by systemd, a launcher or socketpair(). The client upgrades
+ * the socket to x-afb-ws-json1 itself. There is nothing to connect to again after a
+ * hangup, enable_reconnect() has no effect in this mode.
+ */
+int WsClientAudio4a::init_fd(int fd, const string& token) {
+    if (fd < 0 || token.empty()) {
+        ELOG("fd should be >= 0 and token not empty");
+        return -1;
+    }
+    mfd = fd;
+    mtoken = token;
+    muri.clear();
+    return init_loop();
+}
+
+int WsClientAudio4a::init_loop() {
+    int ret;
+    if (mallocation_free) {
+        preallocate();
+    }
 
     ret = initialize_websocket();
     if (ret != 0) {
@@ -123,11 +351,344 @@ int WsClientAudio4a::init(int port, const string& token) {
     return 0;
 }
 
-int WsClientAudio4a::initialize_websocket() {
+/**
+ * This function is initialization function running the client on its own I/O thread
+ *
+ * #### Parameters
+ * - port     [in] : This argument should be specified to the port number to be used for websocket
+ * - token    [in] : This argument should be specified to the token to be used for websocket
+ * - executor [in] : Optional, runs reply, event, hangup and reconnect callbacks instead of the I/O thread
+ *
+ * #### Return
+ * Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * The client owns a private sd_event loop run by a background thread, no loop needs
+ * to be pumped by the application. Any thread may then call the API: calls are pushed
+ * on a lock-free queue and the I/O thread is woken through an eventfd, so issuing
+ * set_stream_state from a media thread takes neither a lock nor a thread hop.
+ * A call made from another thread returns a handle once queued, a failure to send
+ * is reported to its reply handler with Reply_Error.
+ * Callbacks and handlers must be registered before this call. is_pending() and
+ * pending_calls() called from another thread wait for the I/O thread to answer.
+ * Without executor, callbacks run on the I/O thread and must not block it. Replies
+ * and events handed to the executor stay valid until its function returns.
+ */
+int WsClientAudio4a::init_threaded(int port, const string& token, executor_fun executor) {
+    if (port > 0 && token.size() > 0) {
+        mport = port;
+        mtoken = token;
+    } else {
+        ELOG("port and token should be > 0, Initial port and token uses.");
+        return -1;
+    }
+    return init_threaded("ws://localhost:" + to_string(port) + "/api?token=" + token, std::move(executor));
+}
+
+/**
+ * This function is initialization function running the client on its own I/O thread
+ *
+ * #### Parameters
+ * - uri      [in] : websocket URI, see init(const std::string&)
+ * - executor [in] : Optional, runs reply, event, hangup and reconnect callbacks instead of the I/O thread
+ *
+ * #### Return
+ * Returns 0 on success or -1 in case of transmission error.
+ */
+int WsClientAudio4a::init_threaded(const string& uri, executor_fun executor) {
+    if (uri.empty()) {
+        ELOG("uri should not be empty");
+        return -1;
+    }
+    if (mthreaded || mploop) {
+        ELOG("client is already initialized");
+        return -1;
+    }
+
+    mwake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mwake_fd < 0) {
+        ELOG("Failed to create eventfd");
+        return -1;
+    }
+    muri = uri;
+    mexecutor = std::move(executor);
+    mthreaded = true;
+
+    promise<int> started;
+    future<int> result = started.get_future();
+    mio_thread = thread(&WsClientAudio4a::io_main, this, &started);
+    if (result.get() != 0) {
+        ELOG("Failed to initialize websocket");
+        mio_thread.join();
+        mthreaded = false;
+        close(mwake_fd);
+        mwake_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function runs a function on the I/O thread
+ *
+ * #### Parameters
+ * - fn [in] : function to run, right away when called from the I/O thread
+ *
+ * #### Return
+ *
+ * #### Note
+ * Without I/O thread (see init_threaded()) the caller thread is the I/O thread.
+ */
+void WsClientAudio4a::run_on_io(function<void()> fn) {
+    if (on_io_thread()) {
+        fn();
+        return;
+    }
+    IoTask* task = new IoTask;
+    task->fn = std::move(fn);
+    post_task(task);
+}
+
+/**
+ * This function returns the file descriptor to watch from a host event loop
+ *
+ * #### Parameters
+ *
+ * #### Return
+ * - Returns the fd to poll for input, or -1 when unavailable.
+ *
+ * #### Note
+ * This is the fd of the client sd_event loop: it becomes readable for websocket
+ * traffic as well as for expired timers (reconnection, deadlines...), so a host
+ * loop (QSocketNotifier, g_unix_fd_add, asio posix::stream_descriptor) can watch
+ * it instead of pumping the loop on a timer. When readable, or once get_timeout()
+ * expired, call process(). Not available with init_threaded().
+ */
+int WsClientAudio4a::get_fd() const {
+    if (!mploop || mthreaded) return -1;
+    return sd_event_get_fd(mploop);
+}
+
+/**
+ * This function returns how long the host loop may sleep on get_fd()
+ *
+ * #### Parameters
+ *
+ * #### Return
+ * - Returns 0 when work is ready and process() should be called right away,
+ *   -1 to wait for get_fd() with no timeout (poll() convention, milliseconds).
+ *
+ * #### Note
+ * Call it again before each wait, it arms the loop timers.
+ */
+int WsClientAudio4a::get_timeout() {
+    if (!mploop || mthreaded) return -1;
+    switch (sd_event_get_state(mploop)) {
+    case SD_EVENT_INITIAL:
+        return (sd_event_prepare(mploop) > 0) ? 0 : -1;
+    case SD_EVENT_PENDING:
+        return 0;
+    default:
+        /* armed, timers are part of the fd */
+        return -1;
+    }
+}
+
+/**
+ * This function dispatches whatever is ready without blocking
+ *
+ * #### Parameters
+ *
+ * #### Return
+ * - Returns the number of sources dispatched, or -1 in case of error.
+ *
+ * #### Note
+ * Replies, events and timers are handled from the calling thread.
+ */
+int WsClientAudio4a::process() {
+    /* bounded so that an always-pending source cannot starve the host loop */
+    static const int max_dispatch = 64;
+    int ret, count = 0;
+    if (!mploop || mthreaded) return -1;
+
+    while (count < max_dispatch) {
+        switch (sd_event_get_state(mploop)) {
+        case SD_EVENT_ARMED:
+            ret = sd_event_wait(mploop, 0);
+            if (ret > 0) ret = sd_event_dispatch(mploop);
+            break;
+        case SD_EVENT_PENDING:
+            ret = sd_event_dispatch(mploop);
+            break;
+        default:
+            ret = sd_event_run(mploop, 0);
+            break;
+        }
+        if (ret < 0) {
+            ELOG("Failed to process event loop");
+            return -1;
+        }
+        if (ret == 0) break;
+        count++;
+    }
+    return count;
+}
+
+bool WsClientAudio4a::on_io_thread() const {
+    return !mthreaded || this_thread::get_id() == mio_id;
+}
+
+/* from another thread the call is queued, the I/O thread reports it if it cannot be sent */
+bool WsClientAudio4a::ready() const {
+    return on_io_thread() ? sp_websock != NULL : !mstopping.load(memory_order_acquire);
+}
+
+/* either arg or text is the request */
+WsClientAudio4a::RequestHandle WsClientAudio4a::queue_call(Audio4aVerbT verb, struct json_object* arg, string&& text, reply_fun&& on_reply, int role) {
+    if (!audio4a_verb_name(verb) || mstopping.load(memory_order_acquire)) {
+        if (arg) json_object_put(arg);
+        return InvalidRequest;
+    }
+    IoTask* task = new IoTask;
+    task->verb = verb;
+    task->arg = arg;
+    task->text = std::move(text);
+    task->role = role;
+    task->on_reply = std::move(on_reply);
+    RequestHandle ticket = next_ticket();
+    task->ticket = ticket;
+    post_task(task);
+    return ticket;
+}
+
+/* index part 0 keeps tickets apart from slot handles */
+WsClientAudio4a::RequestHandle WsClientAudio4a::next_ticket() {
+    return (mnext_ticket.fetch_add(1, memory_order_relaxed) + 1) << 32;
+}
+
+/* a ticket follows the call it was given for, unless that call needed no round trip;
+   shared calls (coalesced, single-flight queries) carry several */
+void WsClientAudio4a::bind_ticket(RequestHandle ticket, RequestHandle handle) {
+    uint32_t index = pending_index(handle);
+    if (index == NO_PENDING) return;
+    mtickets[ticket] = handle;
+    mpending[index].tickets.push_back(ticket);
+}
+
+/* the eventfd is only written when the I/O thread is not already draining */
+void WsClientAudio4a::post_task(IoTask* task) {
+    mio_queue.push(task);
+    if (!mwake_armed.exchange(true, memory_order_acq_rel)) {
+        wake();
+    }
+}
+
+void WsClientAudio4a::wake() {
+    uint64_t one = 1;
+    if (write(mwake_fd, &one, sizeof(one)) < 0) {
+        ELOG("Failed to wake I/O thread");
+    }
+}
+
+void WsClientAudio4a::on_io_wake(void) {
+    uint64_t count;
+    if (read(mwake_fd, &count, sizeof(count)) < 0) {
+        /* EAGAIN, already drained */
+    }
+    mwake_armed.exchange(false, memory_order_acq_rel);
+    IoTask* task;
+    while ((task = mio_queue.pop()) != nullptr) {
+        run_task(task);
+    }
+}
+
+void WsClientAudio4a::run_task(IoTask* task) {
+    if (task->fn) {
+        task->fn();
+    } else {
+        RequestHandle h = task->arg ? submit(task->verb, task->arg, std::move(task->on_reply))
+                                    : submit_text(task->verb, task->text, std::move(task->on_reply), task->role);
+        if (h == InvalidRequest) {
+            if (task->on_reply) task->on_reply(mlast_failure, NULL);
+        } else {
+            bind_ticket(task->ticket, h);
+        }
+    }
+    delete task;
+}
+
+void WsClientAudio4a::io_main(promise<int>* started) {
+    mio_id = this_thread::get_id();
+    if (mallocation_free) {
+        preallocate();
+    }
+    int ret = initialize_websocket(true);
+    if (ret == 0 && sd_event_add_io(mploop, &mwake_source, mwake_fd, EPOLLIN, _on_io_wake_static, this) < 0) {
+        ELOG("Failed to watch eventfd");
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = init_event();
+    }
+    started->set_value(ret);
+
+    if (ret == 0) {
+        while (!mstopping.load(memory_order_acquire)) {
+            if (sd_event_run(mploop, (uint64_t)-1) < 0) {
+                ELOG("I/O loop failed");
+                break;
+            }
+        }
+    }
+    mstopping.store(true, memory_order_release);
+    shutdown_io();
+    /* callers of on_io_sync() whose task was dropped or came too late */
+    lock_guard<mutex> lock(msync_lock);
+    mio_exited = true;
+    msync_cv.notify_all();
+}
+
+/* on the I/O thread, everything it owns goes with it */
+void WsClientAudio4a::shutdown_io() {
+    IoTask* task;
+    while ((task = mio_queue.pop()) != nullptr) {
+        if (task->arg) json_object_put(task->arg);
+        delete task;
+    }
+    if (mwake_source) {
+        sd_event_source_unref(mwake_source);
+        mwake_source = NULL;
+    }
+    if (mreconnect_timer) {
+        sd_event_source_unref(mreconnect_timer);
+        mreconnect_timer = NULL;
+    }
+    if (msubscription_flush) {
+        sd_event_source_unref(msubscription_flush);
+        msubscription_flush = NULL;
+    }
+    if (mevicted_flush) {
+        sd_event_source_unref(mevicted_flush);
+        mevicted_flush = NULL;
+    }
+    if (sp_websock) {
+        afb_wsj1_unref(sp_websock);
+        sp_websock = NULL;
+    }
+    if (mstale_websock) {
+        afb_wsj1_unref(mstale_websock);
+        mstale_websock = NULL;
+    }
+    if (mploop) {
+        sd_event_unref(mploop);
+        mploop = NULL;
+    }
+    mconnected.store(false, memory_order_relaxed);
+}
+
+int WsClientAudio4a::initialize_websocket(bool own_loop) {
     mploop = NULL;
-    onEvent = nullptr;
-    onReply = nullptr;
-    int ret = sd_event_default(&mploop);
+    int ret = own_loop ? sd_event_new(&mploop) : sd_event_default(&mploop);
     if (ret < 0) {
         ELOG("Failed to create event loop");
         goto END;
@@ -137,10 +698,8 @@ int WsClientAudio4a::initialize_websocket() {
         minterface.on_hangup = _on_hangup_static;
         minterface.on_call = _on_call_static;
         minterface.on_event = _on_event_static;
-        string muri = "ws://localhost:" + to_string(mport) + "/api?token=" + mtoken;
-        sp_websock = afb_ws_client_connect_wsj1(mploop, muri.c_str(), &minterface, this);
     }
-    if (sp_websock == NULL) {
+    if (connect_websocket(ahl4a_transport::UpgradeTimeoutMs) < 0) {
         ELOG("Failed to create websocket connection");
         goto END;
     }
@@ -149,341 +708,2389 @@ int WsClientAudio4a::initialize_websocket() {
 END:
     if (mploop) {
         sd_event_unref(mploop);
+        mploop = NULL;
     }
     return -1;
 }
 
-int WsClientAudio4a::init_event() {
-    /* subscribe most important event for sound right */
-    return subscribe(string("asyncSetSourceState"));
+int WsClientAudio4a::connect_websocket(int upgrade_timeout_ms) {
+    int fd = -1;
+    string target;
+    if (mfd >= 0) {
+        /* given to init_fd(), used once */
+        fd = mfd;
+        mfd = -1;
+        target = "/api?token=" + mtoken;
+    } else if (ahl4a_transport::is_unix_uri(muri)) {
+        fd = ahl4a_transport::connect_unix(muri, &target);
+        if (fd < 0) {
+            ELOG("Failed to connect to %s: %s", muri.c_str(), strerror(errno));
+        }
+    } else if (!muri.empty()) {
+        sp_websock = afb_ws_client_connect_wsj1(mploop, muri.c_str(), &minterface, this);
+    }
+    if (fd >= 0) {
+        /* what afb_ws_client_connect_wsj1() does once its TCP socket is connected */
+        if (ahl4a_transport::upgrade(fd, target, upgrade_timeout_ms) == 0) {
+            sp_websock = afb_wsj1_create(mploop, fd, &minterface, this);
+        } else {
+            ELOG("websocket upgrade refused");
+        }
+        if (!sp_websock) {
+            close(fd);
+        }
+    }
+    mconnected.store(sp_websock != NULL, memory_order_relaxed);
+    return sp_websock ? 0 : -1;
 }
 
 /**
- * This function register callback function for reply/event message from sound manager
+ * This function enables automatic reconnection after hangup
  *
  * #### Parameters
- * - event_cb  [in] : This argument should be specified to the callback for subscribed event
-
-
-
- * - reply_cb  [in] : This argument should be specified to the reply callback for call function
- * - hangup_cb [in] : This argument should be specified to the hangup callback for call function. nullptr is defaulty set.
+ * - enable         [in] : true to reconnect after hangup
+ * - min_backoff_us [in] : delay before the first attempt, doubled after each failure
+ * - max_backoff_us [in] : upper bound of the delay between attempts
  *
  * #### Return
  *
  * #### Note
- * Event callback is invoked by sound manager for event you subscribed.
- * If you would like to get event, please call subscribe function before/after this function
+ * Attempts run as timers on the client sd_event loop, the hangup callback is still invoked.
+ * Once connected again, events given to subscribe() are subscribed again and streams
+ * opened through stream_open() are reopened with their role, endpoint and last
+ * state/mute, then the reconnect handler gets the old to new stream ID mapping.
+ * Calls in flight at hangup complete with Reply_Hangup.
  */
-void WsClientAudio4a::register_callback(
-        void (*event_cb)(const string& event, struct json_object* event_contents),
-        void (*reply_cb)(struct json_object* reply_contents),
-        void (*hangup_cb)(void)) {
-    onEvent = event_cb;
-    onReply = reply_cb;
-    onHangup = hangup_cb;
+void WsClientAudio4a::enable_reconnect(bool enable, uint64_t min_backoff_us, uint64_t max_backoff_us) {
+    mreconnect = enable;
+    mbackoff_min_us = min_backoff_us;
+    mbackoff_max_us = max(min_backoff_us, max_backoff_us);
+    mbackoff_us = mbackoff_min_us;
 }
 
 /**
- * This function is overload of register_callback. This registers callback function for reply/event message from sound manager
+ * This function registers the callback invoked once the session is restored after reconnection
  *
  * #### Parameters
- * - reply_cb [in] : This argument should be specified to the reply callback for call function
- * - hangup_cb [in] : This argument should be specified to the hangup callback for call function. nullptr is defaulty set.
- *
- * #### Return
- *
- * #### Note
- * Event callback is invoked by sound manager for event you subscribed.
- * This function for convinience for user uses set_event_handler
- * If you would like to get event, please call subscribe function before/after this function
+ * - f [in] : receives old and new ID of every reopened stream
  */
-void WsClientAudio4a::register_callback(
-        void (*reply_cb)(struct json_object* reply_contents),
-        void (*hangup_cb)(void)) {
-    onReply = reply_cb;
-    onHangup = hangup_cb;
+void WsClientAudio4a::set_reconnect_handler(reconnect_fun f) {
+    onReconnect = std::move(f);
+}
+
+bool WsClientAudio4a::is_connected() const {
+    return mconnected.load(memory_order_relaxed);
+}
+
+void WsClientAudio4a::schedule_reconnect() {
+    uint64_t now;
+    if (!mploop || mreconnect_timer) return;
+    sd_event_now(mploop, CLOCK_MONOTONIC, &now);
+    /* 1 ms slack, the default 250 ms of sd-event would dwarf the first backoff steps */
+    if (sd_event_add_time(mploop, &mreconnect_timer, CLOCK_MONOTONIC, now + mbackoff_us, 1000,
+                          _on_reconnect_timer_static, this) < 0) {
+        ELOG("Failed to arm reconnect timer");
+        mreconnect_timer = NULL;
+    }
+}
+
+void WsClientAudio4a::on_reconnect_timer(void) {
+    sd_event_source_unref(mreconnect_timer);
+    mreconnect_timer = NULL;
+    if (mstale_websock) {
+        afb_wsj1_unref(mstale_websock);
+        mstale_websock = NULL;
+    }
+    if (sp_websock || !mreconnect) return;
+
+    /* runs on the loop, a unix: upgrade blocks it at most ReconnectUpgradeTimeoutMs */
+    if (connect_websocket(ahl4a_transport::ReconnectUpgradeTimeoutMs) < 0) {
+        DLOG("reconnect failed, next attempt in %llu us", (unsigned long long)mbackoff_us);
+        mbackoff_us = min(mbackoff_us * 2, mbackoff_max_us);
+        schedule_reconnect();
+        return;
+    }
+    mbackoff_us = mbackoff_min_us;
+    restore_session();
+}
+
+void WsClientAudio4a::restore_session() {
+    /* the new session has none, all of them go in one call */
+    flush_subscriptions();
+
+    struct Restore {
+        vector<StreamRemap> streams;
+        size_t remaining;
+    };
+    shared_ptr<Restore> restore = make_shared<Restore>();
+    unordered_map<int, TrackedStream> previous;
+    previous.swap(mstreams);
+    restore->remaining = previous.size() + 1;
+
+    for (auto& it : previous) {
+        int old_id = it.first;
+        TrackedStream info = it.second;
+        const TrackedStream& saved = it.second;
+        string& text = send_buffer();
+        ahl4a_json::stream_open(text, info.audio_role, info.endpoint_type, info.endpoint_id);
+        string state = info.state;
+        bool mute = info.mute;
+        int role = role_index(info.audio_role);
+        RequestHandle h = submit_text(AUDIO4A_VERB_STREAM_OPEN, text, track_open(std::move(info),
+            [this, restore, old_id, saved, state, mute](int status, json_object* reply) {
+                int new_id = (status == Reply_Ok) ? reply_stream_id(reply) : -1;
+                if (status == Reply_Hangup) {
+                    /* lost again, kept for the next attempt */
+                    mstreams[old_id] = saved;
+                }
+                if (new_id >= 0 && (state != AHL_STREAM_STATE_IDLE || mute)) {
+                    set_stream_state(new_id, state, mute, [](int, json_object*) {});
+                }
+                restore->streams.push_back(StreamRemap{old_id, new_id});
+                if (--restore->remaining == 0) {
+                    notify_reconnect(restore->streams);
+                }
+            }), role);
+        if (h == InvalidRequest) {
+            restore->streams.push_back(StreamRemap{old_id, -1});
+            restore->remaining--;
+        }
+    }
+    if (--restore->remaining == 0) {
+        notify_reconnect(restore->streams);
+    }
+}
+
+void WsClientAudio4a::notify_reconnect(const vector<StreamRemap>& streams) {
+    if (!onReconnect) return;
+    if (mexecutor) {
+        mexecutor([this, streams]() { onReconnect(streams); });
+    } else {
+        onReconnect(streams);
+    }
+}
+
+int WsClientAudio4a::init_event() {
+    /* subscribe most important event for sound right */
+    return subscribe(string(event_names[Event_AsyncSetSourceState]));
+}
+
+/**
+ * This function register callback function for reply/event message from sound manager
+ *
+ * #### Parameters
+ * - event_cb  [in] : This argument should be specified to the callback for subscribed event
+
+
+
+ * - reply_cb  [in] : This argument should be specified to the reply callback for call function
+ * - hangup_cb [in] : This argument should be specified to the hangup callback for call function. nullptr is defaulty set.
+ *
+ * #### Return
+ *
+ * #### Note
+ * Event callback is invoked by sound manager for event you subscribed.
+ * If you would like to get event, please call subscribe function before/after this function
+ */
+void WsClientAudio4a::register_callback(
+        void (*event_cb)(const string& event, struct json_object* event_contents),
+        void (*reply_cb)(struct json_object* reply_contents),
+        void (*hangup_cb)(void)) {
+    onEvent = event_cb;
+    onReply = reply_cb;
+    onHangup = hangup_cb;
+}
+
+/**
+ * This function is overload of register_callback. This registers callback function for reply/event message from sound manager
+ *
+ * #### Parameters
+ * - reply_cb [in] : This argument should be specified to the reply callback for call function
+ * - hangup_cb [in] : This argument should be specified to the hangup callback for call function. nullptr is defaulty set.
+ *
+ * #### Return
+ *
+ * #### Note
+ * Event callback is invoked by sound manager for event you subscribed.
+ * This function for convinience for user uses set_event_handler
+ * If you would like to get event, please call subscribe function before/after this function
+ */
+void WsClientAudio4a::register_callback(
+        void (*reply_cb)(struct json_object* reply_contents),
+        void (*hangup_cb)(void)) {
+    onReply = reply_cb;
+    onHangup = hangup_cb;
+}
+
+/**
+ * This function calls registerSource of Audio Manager via WebSocket
+ * registerSource is registration as source for policy management
+ *
+ * #### Parameters
+ * - sourceName [in] : This argument should be specified to the source name (e.g. "MediaPlayer")
+ *
+ * #### Return
+ * - Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * This function must be called to get source ID
+ * mainConnectionID is returned by async reply function
+ *
+ */
+int WsClientAudio4a::registerSource(const string& sourceName) {
+    if (!ready()) {
+        return -1;
+    }
+    struct json_object* j_obj = json_object_new_object();
+    struct json_object* jsn = json_object_new_string(sourceName.c_str());
+    json_object_object_add(j_obj, "appname", jsn);
+    return this->call(__FUNCTION__, j_obj);
+}
+
+/**
+ * This function calls connect of Audio Manager via WebSocket
+ * connect is to get sound right
+ *
+ * #### Parameters
+ * - sourceID [in] : This argument should be specified to the sourceID as int. This parameter is returned value of registerSource
+ * - sinkID   [in] : This argument should be specified to the sinkID as int. ID is specified by AudioManager
+ *
+ * #### Return
+ * - Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * This function must be called to get source right
+ * connectionID is returned by reply event
+ *
+ */
+int WsClientAudio4a::stream_open(const string& audioRole, const string& endPointString, const int endpointID) {
+
+    if (!ready()) return -1;
+
+    string& text = send_buffer();
+    ahl4a_json::stream_open(text, audioRole, endPointString, endpointID);
+
+    TrackedStream info{audioRole, endPointString, endpointID, AHL_STREAM_STATE_IDLE, false};
+    return (submit_text(AUDIO4A_VERB_STREAM_OPEN, text, track_open(std::move(info), nullptr),
+                        role_index(audioRole)) != InvalidRequest) ? 0 : -1;
+
+}
+
+/**
+ * This function calls connect of Audio Manager via WebSocket
+ * connect is to get sound right
+ *
+ * #### Parameters
+ * - audioRole [in] : Audio Role as defined within audio-4a Configuration
+ * - endPointType [in] : Either AUDIO4A_ENDPOINT_SINK or AUDIO4A_ENDPOINT_SOURCE
+ *
+ * #### Return
+ * - Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * This function must be called to get source right
+ * connectionID is returned by reply event
+ *
+ */
+int WsClientAudio4a::stream_open(const string& audioRole, EndPointType4aT endPointType, const int endpointID) {
+    return (stream_open(audioRole, endPointType, endpointID, nullptr) != InvalidRequest) ? 0 : -1;
+}
+
+/**
+ * This function is overload of stream_open with its own completion handler
+ *
+ * #### Parameters
+ * - audioRole [in] : Audio Role as defined within audio-4a Configuration
+ * - endPointType [in] : Either AUDIO4A_ENDPOINT_SINK or AUDIO4A_ENDPOINT_SOURCE
+ * - on_reply [in] : Called once with the reply of this very call (stream_id is in response)
+ *
+ * #### Return
+ * - Returns a request handle on success or InvalidRequest in case of transmission error.
+ *
+ * #### Note
+ * When on_reply is nullptr the reply goes to the callback set by register_callback
+ *
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::stream_open(const string& audioRole, EndPointType4aT endPointType, const int endpointID, reply_fun on_reply) {
+
+    if (!ready()) return InvalidRequest;
+
+    const char* type = endpoint_type_string(endPointType);
+    if (!type) return InvalidRequest;
+    string& text = send_buffer();
+    ahl4a_json::stream_open(text, audioRole, type, endpointID);
+
+    TrackedStream info{audioRole, type, endpointID, AHL_STREAM_STATE_IDLE, false};
+    return submit_text(AUDIO4A_VERB_STREAM_OPEN, text, track_open(std::move(info), std::move(on_reply)),
+                       role_index(audioRole));
+}
+
+
+/**
+ * This function calls the disconnect of Audio Manager via WebSocket
+ *
+ * #### Parameters
+ * - connectionID  [in] : This parameter is returned value of connect
+ *
+ * #### Return
+ * - Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ *
+ *
+ */
+int WsClientAudio4a::stream_close(int streamID) {
+    return (stream_close(streamID, nullptr) != InvalidRequest) ? 0 : -1;
+}
+
+/**
+ * This function is overload of stream_close with its own completion handler
+ *
+ * #### Parameters
+ * - streamID  [in] : This parameter is returned value of stream_open
+ * - on_reply  [in] : Called once with the reply of this very call
+ *
+ * #### Return
+ * - Returns a request handle on success or InvalidRequest in case of transmission error.
+ *
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::stream_close(int streamID, reply_fun on_reply) {
+
+    if (!ready()) return InvalidRequest;
+
+    if (!on_io_thread()) {
+        /* the stream table belongs to the I/O thread, the role of the stream is known there */
+        RequestHandle ticket = next_ticket();
+        run_on_io([this, ticket, streamID, on_reply = std::move(on_reply)]() mutable {
+            bind_ticket(ticket, send_stream_close(streamID, std::move(on_reply), true));
+        });
+        return ticket;
+    }
+    return send_stream_close(streamID, std::move(on_reply), false);
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::send_stream_close(int streamID, reply_fun&& on_reply, bool report_failure) {
+    int role = stream_role(streamID);
+    mstreams.erase(streamID);
+    auto q = mqueries.find("stream/" + to_string(streamID));
+    if (q != mqueries.end()) {
+        if (q->second.in_flight) {
+            invalidate_queries(Query_StreamInfo, "", streamID);
+        } else {
+            if (q->second.reply) json_object_put(q->second.reply);
+            mqueries.erase(q);
+        }
+    }
+    reply_fun f = user_reply(std::move(on_reply));
+    string& text = send_buffer();
+    ahl4a_json::stream_close(text, streamID);
+    RequestHandle h = submit_text(AUDIO4A_VERB_STREAM_CLOSE, text, std::move(f), role);
+    if (h == InvalidRequest && report_failure && f) f(mlast_failure, NULL);
+    return h;
+}
+
+/* audio role index of a stream opened by this client, "none" for the others */
+int WsClientAudio4a::stream_role(int streamID) const {
+    auto it = mstreams.find(streamID);
+    return (it != mstreams.end()) ? role_index(it->second.audio_role) : ROLE_NONE;
+}
+
+/**
+ * This function calls the set_stream_state of Audio Manager via WebSocket
+ *
+ * #### Parameters
+ * - sourceID  [in] : is NULL change all stream for current client, otherwise change on one stream
+ * - state     [in] : idle / idle
+ * - mute      [in] : true / false 
+ *
+ * #### Return
+ * - Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * This function must be called when application get asyncSetSourceState event
+ * Input handle number attached in asyncSetSourceState and error number(0 is acknowledge)
+ */
+int WsClientAudio4a::set_stream_state(int streamID, const string& state, const bool mute) {
+    return (set_stream_state(streamID, state, mute, nullptr) != InvalidRequest) ? 0 : -1;
+}
+
+/**
+ * This function is overload of set_stream_state with its own completion handler
+ *
+ * #### Parameters
+ * - streamID  [in] : Stream to change, as returned in stream_open reply
+ * - state     [in] : idle / running / paused
+ * - mute      [in] : true / false
+ * - on_reply  [in] : Called once with the reply of this very call
+ *
+ * #### Return
+ * - Returns a request handle on success or InvalidRequest in case of transmission error.
+ *
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::set_stream_state(int streamID, const string& state, const bool mute, reply_fun on_reply) {
+    if (!ready()) return InvalidRequest;
+
+    if (!on_io_thread()) {
+        /* the stream table belongs to the I/O thread, check there */
+        RequestHandle ticket = next_ticket();
+        run_on_io([this, ticket, streamID, state, mute, on_reply = std::move(on_reply)]() mutable {
+            bind_ticket(ticket, send_stream_state(streamID, state, mute, std::move(on_reply), true));
+        });
+        return ticket;
+    }
+    return send_stream_state(streamID, state, mute, std::move(on_reply), false);
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::send_stream_state(int streamID, const string& state, bool mute, reply_fun&& on_reply, bool report_failure) {
+    auto it = mstreams.find(streamID);
+    if (msuppress_redundant && it != mstreams.end() && it->second.state_calls == 0 &&
+        it->second.state == state && it->second.mute == mute) {
+        /* nothing would change, answer without a round trip */
+        if (on_reply || onReply != nullptr) {
+            json_object* reply = unchanged_reply(streamID);
+            if (reply) {
+                reply_to(on_reply, Reply_Ok, reply);
+                json_object_put(reply);
+            }
+        }
+        return next_ticket();
+    }
+
+    reply_fun f = user_reply(std::move(on_reply));
+    string& text = send_buffer();
+    ahl4a_json::stream_state(text, streamID, state, mute);
+    int role = (it != mstreams.end()) ? role_index(it->second.audio_role) : ROLE_NONE;
+    RequestHandle h = submit_text(AUDIO4A_VERB_SET_STREAM_STATE, text, std::move(f), role);
+    if (h == InvalidRequest) {
+        if (report_failure && f) f(mlast_failure, NULL);
+        return h;
+    }
+    /* applied by complete_pending(), no closure needed */
+    uint32_t index = pending_index(h);
+    if (index == NO_PENDING) {
+        return h;
+    }
+    PendingCall& pc = mpending[index];
+    pc.track_stream = streamID;
+    pc.track_state = state;
+    pc.track_mute = mute;
+    if (it != mstreams.end()) {
+        it->second.state_calls++;
+    }
+    return h;
+}
+
+/* one reply object reused while no executor may still hold the previous one */
+json_object* WsClientAudio4a::unchanged_reply(int streamID) {
+    json_object* reply;
+    if (!mexecutor && munchanged) {
+        json_object_set_int(munchanged_id, streamID);
+        return json_object_get(munchanged);
+    }
+    if (wrap_json_pack(&reply, "{s:s,s:{s:s,s:s},s:{s:i}}", "jtype", "afb-reply",
+                       "request", "status", "success", "info", "unchanged",
+                       "response", "stream_id", streamID) != 0) {
+        return NULL;
+    }
+    if (!mexecutor) {
+        json_object *response;
+        if (json_object_object_get_ex(reply, "response", &response) &&
+            json_object_object_get_ex(response, "stream_id", &munchanged_id)) {
+            munchanged = json_object_get(reply);
+        }
+    }
+    return reply;
+}
+
+/**
+ * This function reads a stream from the local table, no request is sent
+ *
+ * #### Parameters
+ * - streamID [in]  : stream as returned in stream_open reply
+ * - info     [out] : role, endpoint and last known state and mute flag
+ *
+ * #### Return
+ * - Returns false when the stream was not opened by this client.
+ *
+ * #### Note
+ * The table is filled from stream_open replies and kept current from acknowledged
+ * set_stream_state calls and AHL_STREAM_STATE_EVENT. With init_threaded() only
+ * call it from the I/O thread (see run_on_io()).
+ */
+bool WsClientAudio4a::get_stream(int streamID, StreamInfo* info) const {
+    auto it = mstreams.find(streamID);
+    if (it == mstreams.end()) return false;
+    const TrackedStream& t = it->second;
+    *info = StreamInfo{it->first, t.audio_role, t.endpoint_type, t.endpoint_id, t.state, t.mute};
+    return true;
+}
+
+std::vector<WsClientAudio4a::StreamInfo> WsClientAudio4a::get_streams() const {
+    vector<StreamInfo> streams;
+    streams.reserve(mstreams.size());
+    for (const auto& it : mstreams) {
+        const TrackedStream& t = it.second;
+        streams.push_back(StreamInfo{it.first, t.audio_role, t.endpoint_type, t.endpoint_id, t.state, t.mute});
+    }
+    return streams;
+}
+
+/**
+ * This function controls local answers to set_stream_state
+ *
+ * #### Parameters
+ * - enable [in] : true (default) to answer locally a set_stream_state that would change nothing
+ *
+ * #### Note
+ * A request is answered locally when the stream has no set_stream_state in flight
+ * and its known state and mute flag already match. The handler then gets Reply_Ok
+ * with {"request":{"status":"success","info":"unchanged"}} before the call returns,
+ * and the returned handle is never pending.
+ */
+void WsClientAudio4a::suppress_redundant_state(bool enable) {
+    msuppress_redundant = enable;
+}
+
+/**
+ * This function lists the endpoints of an audio role
+ *
+ * #### Parameters
+ * - audioRole    [in] : audio role as defined in Audio-4A policy config
+ * - endPointType [in] : sink or source
+ * - on_reply     [in] : Called once with the reply, endpoints are in its "response"
+ *
+ * #### Return
+ * - Returns a request handle, or InvalidRequest in case of transmission error.
+ *
+ * #### Note
+ * Answers come from a client-side cache when possible: a cached reply is handed to
+ * on_reply before this function returns and the handle is never pending.
+ * Identical queries issued while one is in flight share its round trip.
+ * Endpoint entries are invalidated by AHL_ENDPOINT_VOLUME_EVENT and
+ * AHL_ENDPOINT_PROPERTY_EVENT, which the client subscribes to on first use,
+ * stream entries by AHL_STREAM_STATE_EVENT and this client's stream calls.
+ * Everything is dropped on hangup. See set_query_cache() for a TTL.
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::get_endpoints(const string& audioRole, EndPointType4aT endPointType, reply_fun on_reply) {
+    const char* type = endpoint_type_string(endPointType);
+    json_object* j_obj;
+    if (!ready() || !type) return InvalidRequest;
+    if (wrap_json_pack(&j_obj, "{s:s,s:s}", "audio_role", audioRole.c_str(), "endpoint_type", type)) return InvalidRequest;
+
+    string key = string("endpoints/") + type + "/" + audioRole;
+    return query(std::move(key), Query_Endpoints, type, -1, AUDIO4A_VERB_GET_ENDPOINTS, j_obj, std::move(on_reply), false);
+}
+
+/**
+ * This function reads the information of one endpoint, see get_endpoints() for caching
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::get_endpoint_info(int endpointID, EndPointType4aT endPointType, reply_fun on_reply) {
+    const char* type = endpoint_type_string(endPointType);
+    json_object* j_obj;
+    if (!ready() || !type) return InvalidRequest;
+    if (wrap_json_pack(&j_obj, "{s:i,s:s}", "endpoint_id", endpointID, "endpoint_type", type)) return InvalidRequest;
+
+    string key = string("endpoint/") + type + "/" + to_string(endpointID);
+    return query(std::move(key), Query_EndpointInfo, type, endpointID, AUDIO4A_VERB_GET_ENDPOINT_INFO, j_obj, std::move(on_reply), false);
+}
+
+/**
+ * This function reads the information of one stream, see get_endpoints() for caching
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::get_stream_info(int streamID, reply_fun on_reply) {
+    json_object* j_obj;
+    if (!ready()) return InvalidRequest;
+    if (wrap_json_pack(&j_obj, "{s:i}", "stream_id", streamID)) return InvalidRequest;
+
+    string key = "stream/" + to_string(streamID);
+    return query(std::move(key), Query_StreamInfo, "", streamID, AUDIO4A_VERB_GET_STREAM_INFO, j_obj, std::move(on_reply), false);
+}
+
+/**
+ * This function configures the query cache
+ *
+ * #### Parameters
+ * - enable [in] : false to always ask the service, concurrent queries are still shared
+ * - ttl_us [in] : maximum age of a cached reply, 0 to rely on invalidation events only
+ */
+void WsClientAudio4a::set_query_cache(bool enable, uint64_t ttl_us) {
+    mquery_cache = enable;
+    mquery_ttl_us = ttl_us;
+    if (!enable) {
+        run_on_io([this]() { clear_queries(); });
+    }
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::query(string&& key, QueryKind kind, const char* endpoint_type, int id,
+                                                      Audio4aVerbT verb, struct json_object* arg, reply_fun&& on_reply, bool report_failure) {
+    if (!on_io_thread()) {
+        if (mstopping.load(memory_order_acquire)) {
+            json_object_put(arg);
+            return InvalidRequest;
+        }
+        /* arg rides in the task, shutdown_io() releases it if the task never runs */
+        IoTask* task = new IoTask;
+        RequestHandle ticket = next_ticket();
+        string type(endpoint_type);
+        task->arg = arg;
+        task->fn = [this, task, ticket, key = std::move(key), kind, type, id, verb, on_reply = std::move(on_reply)]() mutable {
+            struct json_object* a = task->arg;
+            task->arg = nullptr;
+            bind_ticket(ticket, query(std::move(key), kind, type.c_str(), id, verb, a, std::move(on_reply), true));
+        };
+        post_task(task);
+        return ticket;
+    }
+
+    if (kind != Query_StreamInfo && !mendpoint_events) {
+        /* endpoint entries can only be trusted while their events come in */
+        mendpoint_events = true;
+        subscribe(AHL_ENDPOINT_VOLUME_EVENT);
+        subscribe(AHL_ENDPOINT_PROPERTY_EVENT);
+    }
+
+    auto inserted = mqueries.try_emplace(std::move(key));
+    const string& entry_key = inserted.first->first;
+    QueryEntry& e = inserted.first->second;
+    if (inserted.second) {
+        e.kind = kind;
+        e.endpoint_type = endpoint_type;
+        e.id = id;
+    }
+
+    if (e.reply && (!mquery_ttl_us || now_ns() / 1000 - e.fetched_us < mquery_ttl_us)) {
+        json_object_put(arg);
+        /* held, the handler may invalidate the entry */
+        json_object* reply = json_object_get(e.reply);
+        reply_to(on_reply, Reply_Ok, reply);
+        json_object_put(reply);
+        return next_ticket();
+    }
+    if (e.in_flight) {
+        json_object_put(arg);
+        e.waiters.push_back(std::move(on_reply));
+        return e.handle;
+    }
+
+    uint32_t generation = e.generation;
+    RequestHandle h = submit(verb, arg, [this, entry_key, generation](int status, json_object* reply) {
+        complete_query(entry_key, generation, status, reply);
+    });
+    if (h == InvalidRequest) {
+        if (report_failure && on_reply) reply_to(on_reply, mlast_failure, NULL);
+        return InvalidRequest;
+    }
+    e.in_flight = true;
+    e.handle = h;
+    e.waiters.push_back(std::move(on_reply));
+    return h;
+}
+
+void WsClientAudio4a::complete_query(const string& key, uint32_t generation, int status, struct json_object* reply) {
+    auto it = mqueries.find(key);
+    if (it == mqueries.end()) return;
+    QueryEntry& e = it->second;
+
+    vector<reply_fun> waiters;
+    waiters.swap(e.waiters);
+    e.in_flight = false;
+    e.handle = InvalidRequest;
+    /* not kept when invalidated while in flight, the next query asks again */
+    if (status == Reply_Ok && reply && mquery_cache && e.generation == generation) {
+        if (e.reply) json_object_put(e.reply);
+        e.reply = json_object_get(reply);
+        e.fetched_us = now_ns() / 1000;
+    }
+    for (const reply_fun& f : waiters) {
+        reply_to(f, status, reply);
+    }
+}
+
+/* endpoint_type empty matches any, id -1 matches any */
+void WsClientAudio4a::invalidate_queries(QueryKind kind, string_view endpoint_type, int id) {
+    for (auto& it : mqueries) {
+        QueryEntry& e = it.second;
+        if (e.kind != kind) continue;
+        if (!endpoint_type.empty() && !e.endpoint_type.empty() && e.endpoint_type != endpoint_type) continue;
+        if (id >= 0 && e.id >= 0 && e.id != id) continue;
+        if (e.reply) {
+            json_object_put(e.reply);
+            e.reply = nullptr;
+        }
+        e.generation++;
+    }
+}
+
+void WsClientAudio4a::invalidate_endpoint_event(EventType_SM et, struct afb_wsj1_msg* msg) {
+    const char* text = afb_wsj1_msg_object_s(msg);
+    string_view type;
+    int id = -1;
+    if (!text) return;
+    if (et == Event_EndpointVolume) {
+        EndpointVolumeEvent ev;
+        if (!decode_event(text, &ev)) return;
+        type = ev.endpoint_type;
+        id = ev.endpoint_id;
+    } else {
+        EndpointPropertyEvent ev;
+        if (!decode_event(text, &ev)) return;
+        type = ev.endpoint_type;
+        id = ev.endpoint_id;
+    }
+    invalidate_queries(Query_EndpointInfo, type, id);
+    invalidate_queries(Query_Endpoints, type, -1);
+
+    /* stream info embeds its endpoint, unknown streams are dropped as well */
+    for (auto& it : mqueries) {
+        QueryEntry& e = it.second;
+        if (e.kind != Query_StreamInfo) continue;
+        auto st = mstreams.find(e.id);
+        if (st != mstreams.end() && (st->second.endpoint_id != id || st->second.endpoint_type != type)) continue;
+        if (e.reply) {
+            json_object_put(e.reply);
+            e.reply = nullptr;
+        }
+        e.generation++;
+    }
+}
+
+void WsClientAudio4a::clear_queries() {
+    for (auto it = mqueries.begin(); it != mqueries.end();) {
+        QueryEntry& e = it->second;
+        if (e.reply) {
+            json_object_put(e.reply);
+            e.reply = nullptr;
+        }
+        e.generation++;
+        /* in-flight entries stay, their reply still goes to the waiters */
+        if (e.in_flight) {
+            ++it;
+        } else {
+            it = mqueries.erase(it);
+        }
+    }
+}
+
+/**
+ * This function sets the volume of an endpoint
+ *
+ * #### Parameters
+ * - endPointType [in] : sink or source
+ * - endpointID   [in] : endpoint to change
+ * - volume       [in] : new volume
+ * - on_reply     [in] : Called once with the reply of the request carrying this value or a newer one
+ *
+ * #### Return
+ * - Returns a request handle, or InvalidRequest in case of transmission error.
+ *
+ * #### Note
+ * See set_coalescing(), a value merged into a later request gets a handle that is never pending.
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::volume(EndPointType4aT endPointType, int endpointID, int volume, reply_fun on_reply) {
+    const char* type = endpoint_type_string(endPointType);
+    if (!ready() || !type) return InvalidRequest;
+    string& text = send_buffer();
+    ahl4a_json::volume(text, type, endpointID, volume);
+
+    string key = string("volume/") + type + "/" + to_string(endpointID);
+    return coalesce(std::move(key), AUDIO4A_VERB_VOLUME, text, std::move(on_reply), false);
+}
+
+/**
+ * This function sets a property of an endpoint (balance, fade, equalizer...)
+ *
+ * #### Parameters
+ * - endPointType [in] : sink or source
+ * - endpointID   [in] : endpoint to change
+ * - propertyName [in] : property as defined in Audio-4A policy config
+ * - value        [in] : new value
+ * - on_reply     [in] : Called once with the reply of the request carrying this value or a newer one
+ *
+ * #### Return
+ * - Returns a request handle, or InvalidRequest in case of transmission error.
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::property(EndPointType4aT endPointType, int endpointID, const string& propertyName, double value, reply_fun on_reply) {
+    const char* type = endpoint_type_string(endPointType);
+    if (!ready() || !type) return InvalidRequest;
+    string& text = send_buffer();
+    ahl4a_json::property(text, type, endpointID, propertyName, value);
+
+    string key = string("property/") + type + "/" + to_string(endpointID) + "/" + propertyName;
+    return coalesce(std::move(key), AUDIO4A_VERB_PROPERTY, text, std::move(on_reply), false);
+}
+
+/**
+ * This function sets one of the standard properties of an endpoint
+ *
+ * #### Parameters
+ * - endPointType [in] : sink or source
+ * - endpointID   [in] : endpoint to change
+ * - property     [in] : Property_Balance, Property_Fade, Property_EqLow, Property_EqMid or Property_EqHigh
+ * - value        [in] : new value
+ * - on_reply     [in] : Called once with the reply of the request carrying this value or a newer one
+ *
+ * #### Return
+ * - Returns a request handle, or InvalidRequest in case of transmission error or unknown property.
+ *
+ * #### Note
+ * Sends the AHL_PROPERTY_* name of ahl-interface.h, policies may define other properties
+ * that are set by name.
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::property(EndPointType4aT endPointType, int endpointID, StandardProperty property, double value, reply_fun on_reply) {
+    if (property < Property_Balance || property >= Property_Max) return InvalidRequest;
+    return this->property(endPointType, endpointID, string(property_names[property]), value, std::move(on_reply));
+}
+
+/**
+ * This function enables last-write-wins coalescing of volume() and property()
+ *
+ * #### Parameters
+ * - enable    [in] : true to coalesce, false (default) sends every value
+ * - window_us [in] : minimum time between two requests for the same endpoint setting
+ *
+ * #### Note
+ * Per endpoint and property at most one request is in flight. Values given meanwhile
+ * replace each other and only the newest one is sent once the request in flight
+ * completed and window_us elapsed since it was sent, so the final value is always
+ * delivered. Callers whose value was replaced get the reply of the request that
+ * carried the newer value. A slider drag costs about one round trip per window.
+ */
+void WsClientAudio4a::set_coalescing(bool enable, uint64_t window_us) {
+    mcoalescing = enable;
+    mcoalesce_window_us = window_us;
+}
+
+/**
+ * This function makes steady-state calls and event delivery allocation free
+ *
+ * #### Parameters
+ * - enable        [in] : true to preallocate at init() and skip reply parsing
+ * - max_in_flight [in] : pending call slots created at init(), more are allocated on demand
+ * - max_streams   [in] : streams tracked without rehashing
+ *
+ * #### Note
+ * Call it before init(). Once the first calls warmed the request buffer up, the client
+ * itself allocates nothing for set_stream_state, stream_close, volume, property,
+ * subscribe/unsubscribe, their replies, and events delivered to the typed handlers
+ * (set_stream_state_handler()...), provided that:
+ * - calls are made from the loop thread: init(), or process() from a foreign loop.
+ *   Calls queued from other threads with init_threaded() allocate their task.
+ * - there is no executor, no legacy event callback and no set_event_handler() for
+ *   the events received, those get a json-c tree.
+ * - reply handlers are nullptr or callables of at most two pointers, so that
+ *   std::function keeps them inline.
+ * - coalescing and the query cache are not used on that path.
+ * The replies of set_stream_state, stream_close, volume, property and event_subscription
+ * are not parsed: their handlers get the status and a NULL reply. A redundant
+ * set_stream_state is answered with a reply reused from call to call.
+ * afb-wsj1 and json-c still allocate for their own framing.
+ */
+void WsClientAudio4a::set_allocation_free(bool enable, size_t max_in_flight, size_t max_streams) {
+    mallocation_free = enable;
+    mprealloc_calls = max_in_flight;
+    mprealloc_streams = max_streams;
+}
+
+/* pools, tables and the request buffer of the loop thread are sized once */
+void WsClientAudio4a::preallocate() {
+    RequestHandle handle;
+    vector<PendingCall*> slots;
+    slots.reserve(mprealloc_calls);
+    while (mpending.size() < mprealloc_calls) {
+        slots.push_back(acquire_pending(&handle));
+    }
+    for (auto it = slots.rbegin(); it != slots.rend(); ++it) {
+        release_pending(*it);
+    }
+    for (PendingCall& pc : mpending) {
+        pc.track_state.reserve(15);
+    }
+    mstreams.reserve(mprealloc_streams);
+    send_buffer().reserve(1024);
+    for (int et = Event_Unknown + 1; et < Event_Max; et++) {
+        intern_event(string(API) + "/" + event_names[et]);
+    }
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::coalesce(string&& key, Audio4aVerbT verb, const string& text, reply_fun&& on_reply, bool report_failure) {
+    if (!on_io_thread()) {
+        RequestHandle ticket = next_ticket();
+        run_on_io([this, ticket, key = std::move(key), verb, text, on_reply = std::move(on_reply)]() mutable {
+            bind_ticket(ticket, coalesce(std::move(key), verb, text, std::move(on_reply), true));
+        });
+        return ticket;
+    }
+    if (!mcoalescing) {
+        reply_fun f = user_reply(std::move(on_reply));
+        RequestHandle h = submit_text(verb, text, std::move(f));
+        if (h == InvalidRequest && report_failure && f) f(mlast_failure, NULL);
+        return h;
+    }
+
+    auto inserted = mcoalesce.try_emplace(std::move(key));
+    CoalesceEntry& e = inserted.first->second;
+    if (inserted.second) {
+        e.owner = this;
+        e.verb = verb;
+    }
+    /* last write wins */
+    e.queued = text;
+    e.has_queued = true;
+    e.waiters.push_back(std::move(on_reply));
+
+    if (e.in_flight) {
+        return next_ticket();
+    }
+    if (mcoalesce_window_us && now_ns() / 1000 - e.last_sent_us < mcoalesce_window_us) {
+        schedule_coalesced(&e);
+        return next_ticket();
+    }
+    return flush_coalesced(&e, report_failure);
+}
+
+/* sends the newest value, report_last is false when the last waiter learns the failure from the return value */
+WsClientAudio4a::RequestHandle WsClientAudio4a::flush_coalesced(CoalesceEntry* e, bool report_last) {
+    shared_ptr<vector<reply_fun>> waiters = make_shared<vector<reply_fun>>();
+    waiters->swap(e->waiters);
+    e->has_queued = false;
+    e->in_flight = true;
+    e->last_sent_us = now_ns() / 1000;
+
+    RequestHandle h = submit_text(e->verb, e->queued, [this, e, waiters](int status, json_object* reply) {
+        e->in_flight = false;
+        for (const reply_fun& f : *waiters) {
+            reply_to(f, status, reply);
+        }
+        if (e->has_queued) {
+            schedule_coalesced(e);
+        }
+    });
+    if (h == InvalidRequest) {
+        e->in_flight = false;
+        size_t n = waiters->size() - (report_last ? 0 : 1);
+        for (size_t i = 0; i < n; i++) {
+            reply_to((*waiters)[i], mlast_failure, NULL);
+        }
+    }
+    return h;
+}
+
+/* next send once the window since the previous one is over */
+void WsClientAudio4a::schedule_coalesced(CoalesceEntry* e) {
+    uint64_t due = e->last_sent_us + mcoalesce_window_us;
+    if (!mcoalesce_window_us || due <= now_ns() / 1000 || !mploop) {
+        flush_coalesced(e, true);
+        return;
+    }
+    if (!e->timer) {
+        /* 1 ms at most on top of the window, not the default 250 ms slack of sd-event */
+        if (sd_event_add_time(mploop, &e->timer, CLOCK_MONOTONIC, due, 1000, _on_coalesce_timer_static, e) < 0) {
+            e->timer = nullptr;
+            flush_coalesced(e, true);
+        }
+        return;
+    }
+    sd_event_source_set_time(e->timer, due);
+    sd_event_source_set_enabled(e->timer, SD_EVENT_ONESHOT);
+}
+
+void WsClientAudio4a::on_coalesce_timer(void* entry) {
+    CoalesceEntry* e = static_cast<CoalesceEntry*> (entry);
+    if (!e->in_flight && e->has_queued) {
+        e->owner->flush_coalesced(e, true);
+    }
+}
+
+/* AHL_STREAM_STATE_EVENT carries either a state or a stream event name */
+void WsClientAudio4a::mirror_stream_event(struct afb_wsj1_msg* msg) {
+    StreamStateEvent ev;
+    const char* text = afb_wsj1_msg_object_s(msg);
+    if (!text || !decode_event(text, &ev)) return;
+    if (!mqueries.empty()) {
+        invalidate_queries(Query_StreamInfo, "", ev.stream_id);
+    }
+    auto it = mstreams.find(ev.stream_id);
+    if (it == mstreams.end()) return;
+
+    TrackedStream& t = it->second;
+    if (ev.state == AHL_STREAM_STATE_IDLE || ev.state == AHL_STREAM_EVENT_STOP) {
+        t.state = AHL_STREAM_STATE_IDLE;
+    } else if (ev.state == AHL_STREAM_STATE_RUNNING || ev.state == AHL_STREAM_EVENT_START ||
+               ev.state == AHL_STREAM_EVENT_RESUME) {
+        t.state = AHL_STREAM_STATE_RUNNING;
+    } else if (ev.state == AHL_STREAM_STATE_PAUSED || ev.state == AHL_STREAM_EVENT_PAUSE) {
+        t.state = AHL_STREAM_STATE_PAUSED;
+    } else if (ev.state == AHL_STREAM_EVENT_MUTE) {
+        t.mute = true;
+    } else if (ev.state == AHL_STREAM_EVENT_UNMUTE) {
+        t.mute = false;
+    }
+}
+
+/**
+ * This function opens several streams in one submission
+ *
+ * #### Parameters
+ * - requests [in] : audio role, endpoint type and endpoint id of each stream to open
+ * - on_done  [in] : Called once when every item got its reply, results follow requests order
+ *
+ * #### Return
+ * - Returns the number of requests sent or -1 when none could be sent.
+ *
+ * #### Note
+ * All requests are encoded first then written back-to-back without waiting for
+ * any reply, so the whole batch costs about one round trip.
+ * Items that could not be encoded or sent are reported with Reply_Error.
+ *
+ */
+int WsClientAudio4a::stream_open_batch(const vector<StreamOpenRequest>& requests, batch_fun on_done) {
+    if (!ready()) return -1;
+
+    vector<string> args(requests.size());
+    vector<int> roles(requests.size());
+    vector<BatchItemResult> results(requests.size(), BatchItemResult{Reply_Error, -1});
+    for (size_t i = 0; i < requests.size(); i++) {
+        const char* type = endpoint_type_string(requests[i].endpoint_type);
+        if (type) ahl4a_json::stream_open(args[i], requests[i].audio_role, type, requests[i].endpoint_id);
+        roles[i] = role_index(requests[i].audio_role);
+    }
+    batch_fun track = [this, requests, on_done = user_batch(std::move(on_done))](const vector<BatchItemResult>& res) {
+        for (size_t i = 0; i < res.size(); i++) {
+            const char* type = endpoint_type_string(requests[i].endpoint_type);
+            if (res[i].status == Reply_Ok && res[i].stream_id >= 0 && type) {
+                mstreams[res[i].stream_id] = TrackedStream{requests[i].audio_role, type, requests[i].endpoint_id, AHL_STREAM_STATE_IDLE, false};
+            }
+        }
+        if (on_done) on_done(res);
+    };
+    return submit_batch(AUDIO4A_VERB_STREAM_OPEN, args, std::move(roles), std::move(results), std::move(track));
+}
+
+/**
+ * This function closes several streams in one submission
+ *
+ * #### Parameters
+ * - streamIDs [in] : streams to close
+ * - on_done   [in] : Called once when every item got its reply, results follow streamIDs order
+ *
+ * #### Return
+ * - Returns the number of requests sent or -1 when none could be sent.
+ *
+ */
+int WsClientAudio4a::stream_close_batch(const vector<int>& streamIDs, batch_fun on_done) {
+    if (!ready()) return -1;
+    if (!on_io_thread()) {
+        if (streamIDs.empty()) return -1;
+        run_on_io([this, streamIDs, on_done]() { stream_close_batch(streamIDs, on_done); });
+        return (int)streamIDs.size();
+    }
+
+    vector<string> args(streamIDs.size());
+    vector<int> roles(streamIDs.size());
+    vector<BatchItemResult> results;
+    results.reserve(streamIDs.size());
+    for (size_t i = 0; i < streamIDs.size(); i++) {
+        ahl4a_json::stream_close(args[i], streamIDs[i]);
+        roles[i] = stream_role(streamIDs[i]);
+        results.push_back(BatchItemResult{Reply_Error, streamIDs[i]});
+    }
+    for (int id : streamIDs) mstreams.erase(id);
+    return submit_batch(AUDIO4A_VERB_STREAM_CLOSE, args, std::move(roles), std::move(results), user_batch(std::move(on_done)));
+}
+
+/**
+ * This function changes state of several streams in one submission
+ *
+ * #### Parameters
+ * - requests [in] : stream id, state and mute flag of each stream
+ * - on_done  [in] : Called once when every item got its reply, results follow requests order
+ *
+ * #### Return
+ * - Returns the number of requests sent or -1 when none could be sent.
+ *
+ */
+int WsClientAudio4a::set_stream_state_batch(const vector<StreamStateRequest>& requests, batch_fun on_done) {
+    if (!ready()) return -1;
+    if (!on_io_thread()) {
+        if (requests.empty()) return -1;
+        run_on_io([this, requests, on_done]() { set_stream_state_batch(requests, on_done); });
+        return (int)requests.size();
+    }
+
+    vector<string> args(requests.size());
+    vector<int> roles(requests.size());
+    vector<BatchItemResult> results;
+    results.reserve(requests.size());
+    for (size_t i = 0; i < requests.size(); i++) {
+        const StreamStateRequest& r = requests[i];
+        ahl4a_json::stream_state(args[i], r.stream_id, r.state, r.mute);
+        results.push_back(BatchItemResult{Reply_Error, r.stream_id});
+        roles[i] = stream_role(r.stream_id);
+        auto it = mstreams.find(r.stream_id);
+        if (it != mstreams.end()) it->second.state_calls++;
+    }
+    batch_fun track = [this, requests, on_done = user_batch(std::move(on_done))](const vector<BatchItemResult>& res) {
+        for (size_t i = 0; i < res.size(); i++) {
+            auto it = mstreams.find(requests[i].stream_id);
+            if (it != mstreams.end() && it->second.state_calls > 0) {
+                it->second.state_calls--;
+            }
+            if (res[i].status == Reply_Ok && it != mstreams.end()) {
+                it->second.state = requests[i].state;
+                it->second.mute = requests[i].mute;
+            }
+        }
+        if (on_done) on_done(res);
+    };
+    int sent = submit_batch(AUDIO4A_VERB_SET_STREAM_STATE, args, std::move(roles), std::move(results), std::move(track));
+    if (sent < 0) {
+        for (const StreamStateRequest& r : requests) {
+            auto it = mstreams.find(r.stream_id);
+            if (it != mstreams.end() && it->second.state_calls > 0) it->second.state_calls--;
+        }
+    }
+    return sent;
+}
+
+/**
+ * This function calls the API of Audio Manager via WebSocket
+ *
+ * #### Parameters
+ * - verb [in] : This argument should be specified to the API name (e.g. "connect")
+ * - arg  [in] : This argument should be specified to the argument of API. And this argument expects JSON object
+ *
+ * #### Return
+ * - Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * To call Audio Manager's APIs, the application should set its function name, arguments to JSON format.
+ *
+ */
+int WsClientAudio4a::call(string_view verb, struct json_object* arg) {
+    return (submit(audio4a_verb_lookup(verb), arg, nullptr) != InvalidRequest) ? 0 : -1;
+}
+
+/**
+ * This function calls the API of Audio Manager via WebSocket
+ * This function is overload function of "call" taking the verb ID, no name lookup is done
+ *
+ * #### Parameters
+ * - verb [in] : This argument should be specified to the verb ID (e.g. AUDIO4A_VERB_STREAM_OPEN)
+ * - arg  [in] : This argument should be specified to the argument of API. And this argument expects JSON object
+ *
+ * #### Return
+ * - Returns 0 on success or -1 in case of transmission error.
+ *
+ * #### Note
+ * To call Audio Manager's APIs, the application should set its function name, arguments to JSON format.
+ *
+ */
+int WsClientAudio4a::call(Audio4aVerbT verb, struct json_object* arg) {
+    return (submit(verb, arg, nullptr) != InvalidRequest) ? 0 : -1;
+}
+
+/**
+ * This function calls the API of Audio Manager via WebSocket with a per-call completion handler
+ *
+ * #### Parameters
+ * - verb     [in] : This argument should be specified to the API name (e.g. "stream_open")
+ * - arg      [in] : This argument should be specified to the argument of API. Ownership is taken
+ * - on_reply [in] : Called once with ReplyStatus and the reply of this very call
+ *
+ * #### Return
+ * - Returns a request handle on success or InvalidRequest in case of transmission error.
+ *
+ * #### Note
+ * Any number of calls may be in flight, each reply is routed to its own handler
+ * without lookup since the pending slot is the afb-wsj1 reply closure.
+ * When on_reply is nullptr the reply goes to the callback set by register_callback
+ *
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::call(string_view verb, struct json_object* arg, reply_fun on_reply) {
+    return submit(audio4a_verb_lookup(verb), arg, user_reply(std::move(on_reply)));
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::call(Audio4aVerbT verb, struct json_object* arg, reply_fun on_reply) {
+    return submit(verb, arg, user_reply(std::move(on_reply)));
+}
+
+/**
+ * This function calls the API of Audio Manager with JSON text, the reply is handed over as text
+ *
+ * #### Parameters
+ * - verb     [in] : This argument should be specified to the API name (e.g. "stream_open")
+ * - args     [in] : JSON object text of the arguments, sent as is
+ * - on_reply [in] : Called once with ReplyStatus and the reply message text
+ *
+ * #### Return
+ * - Returns a request handle on success or InvalidRequest in case of transmission error.
+ *
+ * #### Note
+ * For bridges handing the JSON to another parser (QJsonDocument...): no json_object is
+ * built for the request nor for the reply. The reply text borrows the afb-wsj1 message,
+ * it is only valid until on_reply returns, and is empty when no reply came (Reply_Hangup,
+ * Reply_Timeout...). Streams opened this way are not tracked, see get_stream().
+ *
+ */
+WsClientAudio4a::RequestHandle WsClientAudio4a::call_raw(string_view verb, string_view args, raw_reply_fun on_reply) {
+    return call_raw(audio4a_verb_lookup(verb), args, std::move(on_reply));
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::call_raw(Audio4aVerbT verb, string_view args, raw_reply_fun on_reply) {
+    if (!ready() || !audio4a_verb_name(verb)) return InvalidRequest;
+
+    if (!on_io_thread()) {
+        RequestHandle ticket = next_ticket();
+        run_on_io([this, ticket, verb, text = string(args), on_reply = std::move(on_reply)]() mutable {
+            bind_ticket(ticket, send_raw(verb, text, std::move(on_reply), true));
+        });
+        return ticket;
+    }
+    return send_raw(verb, args, std::move(on_reply), false);
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::send_raw(Audio4aVerbT verb, string_view args, raw_reply_fun&& on_reply, bool report_failure) {
+    /* afb-wsj1 wants a terminated string */
+    string& text = send_buffer();
+    text.assign(args.data(), args.size());
+    RequestHandle h = send(verb, text.c_str(), text.size(), nullptr, ROLE_NONE);
+    if (h == InvalidRequest) {
+        if (report_failure && on_reply) raw_reply_to(on_reply, mlast_failure, NULL);
+        return InvalidRequest;
+    }
+    uint32_t index = pending_index(h);
+    if (on_reply && index != NO_PENDING) {
+        PendingCall* pc = &mpending[index];
+        pc->raw_reply = std::move(on_reply);
+        pc->parse_reply = false;
+    }
+    return h;
+}
+
+/**
+ * Check whether a request is still waiting for its reply
+ *
+ * #### Parameters
+ * - handle [in] : Request handle returned by call or a typed wrapper
+ *
+ * #### Return
+ * - Returns true until the completion handler of the request was invoked
+ *
+ * #### Note
+ * From another thread in init_threaded() mode the answer comes from the I/O thread,
+ * the caller waits for it: the pending calls belong to that thread.
+ */
+bool WsClientAudio4a::is_pending(RequestHandle handle) const {
+    if (on_io_thread()) {
+        return pending_index(handle) != NO_PENDING;
+    }
+    return on_io_sync([this, handle]() { return pending_index(handle) != NO_PENDING; }, false);
+}
+
+/* slot of a request still waiting for its reply, NO_PENDING otherwise */
+uint32_t WsClientAudio4a::pending_index(RequestHandle handle) const {
+    uint32_t index = (uint32_t)(handle & 0xffffffff);
+    if (index == 0 && handle != InvalidRequest) {
+        /* ticket of a call queued from another thread */
+        auto it = mtickets.find(handle);
+        return (it != mtickets.end()) ? pending_index(it->second) : NO_PENDING;
+    }
+    if (index == 0 || index > mpending.size()) {
+        return NO_PENDING;
+    }
+    const PendingCall& pc = mpending[index - 1];
+    return (pc.in_use && pc.generation == (uint32_t)(handle >> 32)) ? index - 1 : NO_PENDING;
+}
+
+/**
+ * Number of calls sent or waiting for the send window, and not yet replied
+ */
+size_t WsClientAudio4a::pending_calls() const {
+    if (on_io_thread()) {
+        return mnpending;
+    }
+    return on_io_sync([this]() { return mnpending; }, (size_t)0);
+}
+
+/**
+ * This function sets the deadline given to every call sent from now on
+ *
+ * #### Parameters
+ * - timeout_us [in] : time allowed for the reply in microseconds, 0 for none (default)
+ *
+ * #### Return
+ *
+ * #### Note
+ * A call not answered in time completes with Reply_Timeout, a reply coming later is dropped.
+ * Internal calls (subscriptions, reconnection, cached queries) get the same deadline.
+ * Deadlines have a millisecond resolution, set_timeout() changes the one of a single call.
+ */
+void WsClientAudio4a::set_default_timeout(uint64_t timeout_us) {
+    mdefault_timeout_us = timeout_us;
+}
+
+/**
+ * This function sets or replaces the deadline of a call in flight
+ *
+ * #### Parameters
+ * - handle     [in] : Request handle returned by call or a typed wrapper
+ * - timeout_us [in] : time allowed from now in microseconds, 0 removes the deadline
+ *
+ * #### Return
+ * - Returns 0 on success or -1 when the request is not pending anymore.
+ *
+ * #### Note
+ * From another thread in init_threaded() mode, it is applied on the I/O thread and returns 0.
+ */
+int WsClientAudio4a::set_timeout(RequestHandle handle, uint64_t timeout_us) {
+    if (!on_io_thread()) {
+        run_on_io([this, handle, timeout_us]() { set_timeout(handle, timeout_us); });
+        return 0;
+    }
+    uint32_t index = pending_index(handle);
+    if (index == NO_PENDING) {
+        return -1;
+    }
+    arm_deadline(&mpending[index], timeout_us);
+    return 0;
+}
+
+/**
+ * This function gives up waiting for the reply of a call
+ *
+ * #### Parameters
+ * - handle [in] : Request handle returned by call or a typed wrapper
+ *
+ * #### Return
+ * - Returns 0 on success or -1 when the request is not pending anymore.
+ *
+ * #### Note
+ * The completion handler is called at once with Reply_Cancelled. The request may
+ * still be executed by the service, its reply is dropped.
+ * From another thread in init_threaded() mode, it is applied on the I/O thread and returns 0.
+ */
+int WsClientAudio4a::cancel(RequestHandle handle) {
+    if (!on_io_thread()) {
+        run_on_io([this, handle]() { cancel(handle); });
+        return 0;
+    }
+    uint32_t index = pending_index(handle);
+    if (index == NO_PENDING) {
+        return -1;
+    }
+    complete_pending(&mpending[index], Reply_Cancelled, NULL, false);
+    return 0;
+}
+
+/* O(1): the loop timer only moves when the new deadline is the earliest */
+void WsClientAudio4a::arm_deadline(PendingCall* pc, uint64_t timeout_us) {
+    if (!timeout_us) {
+        mdeadlines.remove(pc);
+        return;
+    }
+    uint64_t now_us = now_ns() / 1000;
+    mdeadlines.add(pc, (now_us + timeout_us + TICK_US - 1) / TICK_US, now_us / TICK_US);
+    if (mdeadlines.next_due() < mdeadline_armed) {
+        arm_deadline_timer();
+    }
+}
+
+void WsClientAudio4a::arm_deadline_timer() {
+    uint64_t next = mdeadlines.next_due();
+    mdeadline_armed = next;
+    if (next == TimerWheel<PendingCall>::Never) {
+        if (mdeadline_timer) sd_event_source_set_enabled(mdeadline_timer, SD_EVENT_OFF);
+        return;
+    }
+    if (!mdeadline_timer) {
+        /* accuracy 0 would be the default 250 ms slack of sd-event */
+        if (!mploop || sd_event_add_time(mploop, &mdeadline_timer, CLOCK_MONOTONIC, next * TICK_US, TICK_US,
+                                         _on_deadline_timer_static, this) < 0) {
+            ELOG("Failed to add deadline timer");
+            mdeadline_timer = NULL;
+            mdeadline_armed = TimerWheel<PendingCall>::Never;
+        }
+        return;
+    }
+    sd_event_source_set_time(mdeadline_timer, next * TICK_US);
+    sd_event_source_set_time_accuracy(mdeadline_timer, TICK_US);
+    sd_event_source_set_enabled(mdeadline_timer, SD_EVENT_ONESHOT);
+}
+
+void WsClientAudio4a::on_deadline_timer(void) {
+    mdeadline_armed = TimerWheel<PendingCall>::Never;
+    mdeadlines.advance(now_ns() / 1000 / TICK_US, [this](PendingCall* pc) {
+        ELOG("%s timed out", audio4a_verb_name(pc->verb));
+        complete_pending(pc, Reply_Timeout, NULL, false);
+    });
+    arm_deadline_timer();
+}
+
+/**
+ * This function takes a snapshot of the client statistics
+ *
+ * #### Parameters
+ * - stats [out] : per-verb calls, errors, in-flight count and latency histogram,
+ *                 per-role send queue depth and wait histogram (see set_send_window()),
+ *                 per-event receive counters, bytes sent and received
+ * - reset [in]  : clear counters and histograms once copied (in-flight counts are kept)
+ * - parts [in]  : StatsPart mask of the histograms to copy, Stats_Counters for none
+ *
+ * #### Return
+ *
+ * #### Note
+ * Latency is measured from call() to its reply, hangup included.
+ * Recording is lock free and allocation free, it is always on.
+ * Snapshot may be taken from any thread, Stats::to_json() gives a JSON dump.
+ * Stats is about 88 KB with every histogram, keep it off the stack and reuse it.
+ * Histograms left out of parts are neither copied nor cleared.
+ */
+void WsClientAudio4a::get_stats(Stats* stats, bool reset, unsigned parts) {
+    stats->parts = parts & Stats_All;
+    for (int i = 0; i < AUDIO4A_VERB_COUNT; i++) {
+        VerbCounters& vs = mverb_stats[i];
+        Stats::Verb& v = stats->verbs[i];
+        v.calls = reset ? vs.calls.exchange(0, memory_order_relaxed) : vs.calls.load(memory_order_relaxed);
+        v.errors = reset ? vs.errors.exchange(0, memory_order_relaxed) : vs.errors.load(memory_order_relaxed);
+        v.in_flight = vs.in_flight.load(memory_order_relaxed);
+        if (parts & Stats_Latency) vs.latency.snapshot(&v.latency, reset);
+    }
+    for (int i = 0; i < RoleCount; i++) {
+        RoleCounters& rs = mrole_stats[i];
+        Stats::Role& r = stats->roles[i];
+        r.name = role_names[i];
+        r.priority = mrole_priority[i];
+        r.queued = rs.queued.load(memory_order_relaxed);
+        r.max_queued = reset ? rs.max_queued.exchange(r.queued, memory_order_relaxed) : rs.max_queued.load(memory_order_relaxed);
+        if (parts & Stats_Wait) rs.wait.snapshot(&r.wait, reset);
+    }
+    for (int i = 0; i < Event_Max; i++) {
+        stats->events[i] = reset ? mevent_counts[i].exchange(0, memory_order_relaxed) : mevent_counts[i].load(memory_order_relaxed);
+    }
+    stats->bytes_sent = reset ? mbytes_sent.exchange(0, memory_order_relaxed) : mbytes_sent.load(memory_order_relaxed);
+    stats->bytes_received = reset ? mbytes_received.exchange(0, memory_order_relaxed) : mbytes_received.load(memory_order_relaxed);
+    stats->would_block = reset ? mwould_block.exchange(0, memory_order_relaxed) : mwould_block.load(memory_order_relaxed);
+}
+
+/**
+ * JSON dump of a statistics snapshot, latencies in microseconds
+ * Histograms get_stats() left out have no "latency_us" or "wait_us" entry.
+ *
+ * #### Return
+ * - Returns a new json_object, to be released with json_object_put
+ */
+struct json_object* WsClientAudio4a::Stats::to_json() const {
+    struct json_object* j_stats = json_object_new_object();
+    struct json_object* j_verbs = json_object_new_object();
+    struct json_object* j_events = json_object_new_object();
+    struct json_object* j_roles = json_object_new_object();
+
+    for (int i = 0; i < AUDIO4A_VERB_COUNT; i++) {
+        const Verb& v = verbs[i];
+        if (v.calls == 0 && v.errors == 0 && v.in_flight == 0) continue;
+        struct json_object* j_verb = json_object_new_object();
+        json_object_object_add(j_verb, "calls", json_object_new_int64((int64_t)v.calls));
+        json_object_object_add(j_verb, "errors", json_object_new_int64((int64_t)v.errors));
+        json_object_object_add(j_verb, "in_flight", json_object_new_int64((int64_t)v.in_flight));
+        if (parts & Stats_Latency) {
+            struct json_object* j_lat = json_object_new_object();
+            json_object_object_add(j_lat, "count", json_object_new_int64((int64_t)v.latency.count));
+            json_object_object_add(j_lat, "mean", json_object_new_double((double)v.latency.mean() / 1000.0));
+            json_object_object_add(j_lat, "p50", json_object_new_double((double)v.latency.percentile(0.50) / 1000.0));
+            json_object_object_add(j_lat, "p99", json_object_new_double((double)v.latency.percentile(0.99) / 1000.0));
+            json_object_object_add(j_lat, "p999", json_object_new_double((double)v.latency.percentile(0.999) / 1000.0));
+            json_object_object_add(j_lat, "max", json_object_new_double((double)v.latency.max_ns / 1000.0));
+            json_object_object_add(j_verb, "latency_us", j_lat);
+        }
+        json_object_object_add(j_verbs, audio4a_verb_names[i], j_verb);
+    }
+    for (int i = 0; i < RoleCount; i++) {
+        const Role& r = roles[i];
+        bool wait = (parts & Stats_Wait) && r.wait.count != 0;
+        if (r.max_queued == 0 && !wait) continue;
+        struct json_object* j_role = json_object_new_object();
+        json_object_object_add(j_role, "priority", json_object_new_int(r.priority));
+        json_object_object_add(j_role, "queued", json_object_new_int64((int64_t)r.queued));
+        json_object_object_add(j_role, "max_queued", json_object_new_int64((int64_t)r.max_queued));
+        if (parts & Stats_Wait) {
+            struct json_object* j_wait = json_object_new_object();
+            json_object_object_add(j_wait, "count", json_object_new_int64((int64_t)r.wait.count));
+            json_object_object_add(j_wait, "mean", json_object_new_double((double)r.wait.mean() / 1000.0));
+            json_object_object_add(j_wait, "p99", json_object_new_double((double)r.wait.percentile(0.99) / 1000.0));
+            json_object_object_add(j_wait, "max", json_object_new_double((double)r.wait.max_ns / 1000.0));
+            json_object_object_add(j_role, "wait_us", j_wait);
+        }
+        json_object_object_add(j_roles, r.name, j_role);
+    }
+    for (int i = Event_Unknown; i < Event_Max; i++) {
+        if (events[i] == 0) continue;
+        json_object_object_add(j_events, event_names[i] ? event_names[i] : "unknown", json_object_new_int64((int64_t)events[i]));
+    }
+    json_object_object_add(j_stats, "verbs", j_verbs);
+    json_object_object_add(j_stats, "roles", j_roles);
+    json_object_object_add(j_stats, "events", j_events);
+    json_object_object_add(j_stats, "bytes_sent", json_object_new_int64((int64_t)bytes_sent));
+    json_object_object_add(j_stats, "bytes_received", json_object_new_int64((int64_t)bytes_received));
+    json_object_object_add(j_stats, "would_block", json_object_new_int64((int64_t)would_block));
+    return j_stats;
+}
+
+/* json-c path, for arguments built by the application */
+WsClientAudio4a::RequestHandle WsClientAudio4a::submit(Audio4aVerbT verb, struct json_object* arg, reply_fun&& on_reply) {
+    if (!on_io_thread()) {
+        return queue_call(verb, arg, string(), std::move(on_reply), -1);
+    }
+    const char* text = json_object_to_json_string(arg);
+    mlast_failure = Reply_Error;
+    RequestHandle h = text ? send(verb, text, strlen(text), std::move(on_reply), ROLE_NONE) : InvalidRequest;
+    json_object_put(arg);
+    return h;
+}
+
+/* request text written by ahl4a_json, copied when queued for the I/O thread */
+WsClientAudio4a::RequestHandle WsClientAudio4a::submit_text(Audio4aVerbT verb, const string& text, reply_fun&& on_reply, int role) {
+    if (!on_io_thread()) {
+        return queue_call(verb, NULL, string(text), std::move(on_reply), role);
+    }
+    return send(verb, text.c_str(), text.size(), std::move(on_reply), role < 0 ? ROLE_NONE : role);
+}
+
+WsClientAudio4a::RequestHandle WsClientAudio4a::send(Audio4aVerbT verb, const char* text, size_t len, reply_fun&& on_reply, int role) {
+    RequestHandle handle;
+    const char* verb_name = audio4a_verb_name(verb);
+    mlast_failure = Reply_Error;
+    if (!sp_websock) {
+        return InvalidRequest;
+    }
+    if (!verb_name) {
+        ELOG("verb doesn't exit");
+        return InvalidRequest;
+    }
+    VerbCounters& vs = mverb_stats[verb];
+    bool direct;
+    for (;;) {
+        direct = wire_room(len);
+        if (direct || queue_room(len)) break;
+        /* the queue is full: room is made by dropping the newest call of a lower priority */
+        int worst = msend_ready ? 31 - __builtin_clz(msend_ready) : -1;
+        if (worst <= mrole_priority[role]) {
+            mlast_failure = Reply_WouldBlock;
+            mblocked = true;
+            mwould_block.fetch_add(1, memory_order_relaxed);
+            errno = EAGAIN;
+            return InvalidRequest;
+        }
+        mwould_block.fetch_add(1, memory_order_relaxed);
+        evict(msend_tail[worst]);
+    }
+    PendingCall* pc = acquire_pending(&handle);
+    pc->on_reply = std::move(on_reply);
+    pc->verb = verb;
+    pc->sent_ns = now_ns();
+    pc->parse_reply = !mallocation_free || !status_only(verb);
+    pc->role = role;
+    if (!direct) {
+        /* sent by pump_sends() when a reply frees the window */
+        queue_send(pc, text, len);
+    } else if (transmit(pc, text, len) < 0) {
+        ELOG("Failed to call verb:%s", verb_name);
+        vs.errors.fetch_add(1, memory_order_relaxed);
+        /* handed back, the caller may still report the failure */
+        on_reply = std::move(pc->on_reply);
+        release_pending(pc);
+        return InvalidRequest;
+    }
+    vs.calls.fetch_add(1, memory_order_relaxed);
+    vs.in_flight.fetch_add(1, memory_order_relaxed);
+    if (mdefault_timeout_us) {
+        arm_deadline(pc, mdefault_timeout_us);
+    }
+    return handle;
+}
+
+int WsClientAudio4a::transmit(PendingCall* pc, const char* text, size_t len) {
+    int ret = afb_wsj1_call_s(sp_websock, API, audio4a_verb_name(pc->verb), text, _on_reply_static, pc);
+    if (ret >= 0) {
+        pc->wire_bytes = len;
+        mwire_bytes += len;
+        mbytes_sent.fetch_add(len, memory_order_relaxed);
+    }
+    return ret;
+}
+
+/* a request larger than the byte window still goes alone */
+bool WsClientAudio4a::wire_room(size_t len) const {
+    if (msend_window && mnpending - mnqueued - mnevicted >= msend_window) return false;
+    return !msend_window_bytes || mwire_bytes == 0 || mwire_bytes + len <= msend_window_bytes;
+}
+
+bool WsClientAudio4a::queue_room(size_t len) const {
+    return mnqueued < mqueue_max_calls && len <= mqueue_max_bytes - mqueued_bytes;
+}
+
+/* once, after a refusal, as soon as a call would be accepted again */
+void WsClientAudio4a::notify_capacity() {
+    if (!wire_room(0) && !queue_room(0)) return;
+    mblocked = false;
+    if (msubscriptions_refused) {
+        msubscriptions_refused = false;
+        schedule_subscriptions();
+    }
+    if (!mcapacity_handler) return;
+    if (mexecutor) {
+        mexecutor(mcapacity_handler);
+    } else {
+        mcapacity_handler();
+    }
+}
+
+/* FIFO per priority, the slot keeps a copy of the request */
+void WsClientAudio4a::queue_send(PendingCall* pc, const char* text, size_t len) {
+    int prio = mrole_priority[pc->role];
+    pc->queued_text.assign(text, len);
+    pc->queued = true;
+    mqueued_bytes += len;
+    pc->priority = prio;
+    pc->send_next = nullptr;
+    pc->send_prev = msend_tail[prio];
+    if (msend_tail[prio]) msend_tail[prio]->send_next = pc;
+    else msend_head[prio] = pc;
+    msend_tail[prio] = pc;
+    msend_ready |= 1u << prio;
+    mnqueued++;
+
+    RoleCounters& rs = mrole_stats[pc->role];
+    uint64_t depth = rs.queued.fetch_add(1, memory_order_relaxed) + 1;
+    if (depth > rs.max_queued.load(memory_order_relaxed)) {
+        rs.max_queued.store(depth, memory_order_relaxed);
+    }
+}
+
+/*
+ * The room is made at once, the handler runs from the loop: called inside send()
+ * it could call send() again while the queue is being changed.
+ */
+void WsClientAudio4a::evict(PendingCall* pc) {
+    unqueue_send(pc);
+    mdeadlines.remove(pc);
+    pc->evicted = true;
+    mnevicted++;
+    mevicted.push_back(((RequestHandle)pc->generation << 32) | (RequestHandle)(pc->index + 1));
+    if (!mevicted_flush && sd_event_add_defer(mploop, &mevicted_flush, _on_evicted_static, this) < 0) {
+        mevicted_flush = NULL;
+        ELOG("Failed to defer %zu evicted calls", mevicted.size());
+    }
+}
+
+void WsClientAudio4a::on_evicted(void) {
+    sd_event_source_unref(mevicted_flush);
+    mevicted_flush = NULL;
+    vector<RequestHandle> evicted;
+    evicted.swap(mevicted);
+    for (RequestHandle handle : evicted) {
+        /* may be gone already, cancelled or failed by a hangup */
+        uint32_t index = pending_index(handle);
+        if (index != NO_PENDING) {
+            complete_pending(&mpending[index], Reply_WouldBlock, NULL);
+        }
+    }
+}
+
+void WsClientAudio4a::unqueue_send(PendingCall* pc) {
+    int prio = pc->priority;
+    if (pc->send_prev) pc->send_prev->send_next = pc->send_next;
+    else msend_head[prio] = pc->send_next;
+    if (pc->send_next) pc->send_next->send_prev = pc->send_prev;
+    else msend_tail[prio] = pc->send_prev;
+    if (!msend_head[prio]) msend_ready &= ~(1u << prio);
+    pc->send_prev = pc->send_next = nullptr;
+    pc->queued = false;
+    mqueued_bytes -= pc->queued_text.size();
+    mnqueued--;
+    mrole_stats[pc->role].queued.fetch_sub(1, memory_order_relaxed);
+}
+
+/* fills the window again, highest priority first */
+void WsClientAudio4a::pump_sends() {
+    if (mpumping) return;
+    mpumping = true;
+    while (msend_ready && sp_websock) {
+        PendingCall* pc = msend_head[__builtin_ctz(msend_ready)];
+        if (!wire_room(pc->queued_text.size())) break;
+        unqueue_send(pc);
+        mrole_stats[pc->role].wait.record(now_ns() - pc->sent_ns);
+        if (transmit(pc, pc->queued_text.c_str(), pc->queued_text.size()) < 0) {
+            ELOG("Failed to call verb:%s", audio4a_verb_name(pc->verb));
+            complete_pending(pc, Reply_Error, NULL);
+        }
+    }
+    mpumping = false;
+}
+
+/**
+ * This function bounds the number of calls on the wire
+ *
+ * #### Parameters
+ * - max_in_flight       [in] : calls sent and not answered at most, 0 for no limit (default)
+ * - max_in_flight_bytes [in] : request bytes sent and not answered at most, 0 for no limit (default)
+ *
+ * #### Return
+ *
+ * #### Note
+ * Calls over the window wait in the client, one FIFO per priority, and are sent
+ * as replies come back, highest priority first: a warning chime overtakes queued
+ * media state changes and volume updates. A waiting call has its handle, may be
+ * cancelled and its deadline runs. See set_send_queue_limit(), set_role_priority() and Stats::roles.
+ */
+void WsClientAudio4a::set_send_window(size_t max_in_flight, size_t max_in_flight_bytes) {
+    run_on_io([this, max_in_flight, max_in_flight_bytes]() {
+        msend_window = max_in_flight;
+        msend_window_bytes = max_in_flight_bytes;
+        pump_sends();
+        if (mblocked) notify_capacity();
+    });
+}
+
+/**
+ * This function bounds the calls waiting for the send window
+ *
+ * #### Parameters
+ * - max_calls [in] : calls waiting at most, 0 to refuse calls as soon as the window is full
+ * - max_bytes [in] : request bytes waiting at most
+ *
+ * #### Return
+ *
+ * #### Note
+ * Unbounded by default. A call over the limits is refused: it returns InvalidRequest
+ * with errno set to EAGAIN, or its handler gets Reply_WouldBlock when it was made from
+ * another thread in init_threaded() mode. A call of a higher priority is not refused
+ * while calls of a lower priority wait, the newest of those is dropped instead. The
+ * dropped call gets Reply_WouldBlock from the loop, after the call that dropped it
+ * has returned. After a refusal the capacity handler is called once there is room.
+ */
+void WsClientAudio4a::set_send_queue_limit(size_t max_calls, size_t max_bytes) {
+    run_on_io([this, max_calls, max_bytes]() {
+        mqueue_max_calls = max_calls;
+        mqueue_max_bytes = max_bytes;
+        if (mblocked) notify_capacity();
+    });
 }
 
 /**
- * This function calls registerSource of Audio Manager via WebSocket
- * registerSource is registration as source for policy management
+ * This function sets the handler told that calls are accepted again
  *
  * #### Parameters
- * - sourceName [in] : This argument should be specified to the source name (e.g. "MediaPlayer")
+ * - f [in] : called once after each refusal with Reply_WouldBlock, when a call would fit
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
  *
  * #### Note
- * This function must be called to get source ID
- * mainConnectionID is returned by async reply function
- *
+ * Runs on the executor when one was given to init_threaded().
  */
-int WsClientAudio4a::registerSource(const string& sourceName) {
-    if (!sp_websock) {
-        return -1;
-    }
-    struct json_object* j_obj = json_object_new_object();
-    struct json_object* jsn = json_object_new_string(sourceName.c_str());
-    json_object_object_add(j_obj, "appname", jsn);
-    return this->call(__FUNCTION__, j_obj);
+void WsClientAudio4a::set_capacity_handler(capacity_fun f) {
+    run_on_io([this, f = std::move(f)]() mutable { mcapacity_handler = std::move(f); });
 }
 
 /**
- * This function calls connect of Audio Manager via WebSocket
- * connect is to get sound right
+ * This function changes the send priority of an audio role
  *
  * #### Parameters
- * - sourceID [in] : This argument should be specified to the sourceID as int. This parameter is returned value of registerSource
- * - sinkID   [in] : This argument should be specified to the sinkID as int. ID is specified by AudioManager
+ * - role     [in] : AHL_ROLE_*, calls without a known role are AHL_ROLE_NONE
+ * - priority [in] : 0 (first) to PriorityLevels - 1
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
+ * - Returns 0 on success or -1 for an unknown role or priority.
  *
  * #### Note
- * This function must be called to get source right
- * connectionID is returned by reply event
- *
+ * Defaults from first to last: warning, guidance, communication,
+ * notification/startup/shutdown, system, entertainment, none.
+ * Applies to calls queued from now on.
  */
-int WsClientAudio4a::stream_open(const string& audioRole, const string& endPointString, const int endpointID) {
+int WsClientAudio4a::set_role_priority(const string& role, int priority) {
+    int index = role_index(role);
+    if (priority < 0 || priority >= PriorityLevels || (index == ROLE_NONE && role != AHL_ROLE_NONE)) {
+        return -1;
+    }
+    run_on_io([this, index, priority]() { mrole_priority[index] = priority; });
+    return 0;
+}
+
+int WsClientAudio4a::submit_batch(Audio4aVerbT verb, vector<string>& args, vector<int>&& roles,
+                                  vector<BatchItemResult>&& results, batch_fun&& on_done) {
+    struct BatchState {
+        vector<BatchItemResult> results;
+        size_t remaining;
+        batch_fun on_done;
+    };
+    int sent = 0;
+    if (!on_io_thread()) {
+        for (const string& arg : args) {
+            if (!arg.empty()) sent++;
+        }
+        if (sent == 0) return -1;
+        run_on_io([this, verb, args = std::move(args), roles = std::move(roles), results = std::move(results),
+                   on_done = std::move(on_done)]() mutable {
+            submit_batch(verb, args, std::move(roles), std::move(results), std::move(on_done));
+        });
+        return sent;
+    }
+    shared_ptr<BatchState> batch = make_shared<BatchState>();
+    batch->results = std::move(results);
+    batch->remaining = args.size();
+    batch->on_done = std::move(on_done);
+
+    /* hold one extra count so the batch cannot complete while still sending */
+    batch->remaining++;
+    for (size_t i = 0; i < args.size(); i++) {
+        RequestHandle h = InvalidRequest;
+        if (!args[i].empty()) {
+            bool open = (verb == AUDIO4A_VERB_STREAM_OPEN);
+            h = submit_text(verb, args[i], [batch, i, open](int status, json_object* reply) {
+                batch->results[i].status = status;
+                if (open && status == Reply_Ok) {
+                    batch->results[i].stream_id = reply_stream_id(reply);
+                }
+                if (--batch->remaining == 0 && batch->on_done) {
+                    batch->on_done(batch->results);
+                }
+            }, i < roles.size() ? roles[i] : -1);
+        }
+        if (h == InvalidRequest) {
+            batch->remaining--;
+        } else {
+            sent++;
+        }
+    }
+    if (sent == 0) {
+        return -1;
+    }
+    if (--batch->remaining == 0 && batch->on_done) {
+        batch->on_done(batch->results);
+    }
+    return sent;
+}
+
+WsClientAudio4a::PendingCall* WsClientAudio4a::acquire_pending(RequestHandle* handle) {
+    uint32_t index;
+    if (mfree_pending != NO_PENDING) {
+        index = mfree_pending;
+        mfree_pending = mpending[index].next_free;
+    } else {
+        index = (uint32_t)mpending.size();
+        /* members keep their defaults, only what they cannot know is set */
+        PendingCall& slot = mpending.emplace_back();
+        slot.owner = this;
+        slot.index = index;
+        slot.next_free = NO_PENDING;
+        slot.role = ROLE_NONE;
+    }
+    PendingCall* pc = &mpending[index];
+    pc->generation++;
+    pc->in_use = true;
+    pc->tickets.clear();
+    pc->parse_reply = true;
+    pc->track_stream = -1;
+    mnpending++;
+    *handle = ((RequestHandle)pc->generation << 32) | (RequestHandle)(index + 1);
+    return pc;
+}
 
-    if (!sp_websock) return -1;
+/* the slot is reused once afb-wsj1 no longer holds it as a reply closure */
+void WsClientAudio4a::release_pending(PendingCall* pc, bool answered) {
+    if (pc->in_use) {
+        pc->in_use = false;
+        mnpending--;
+    }
+    pc->on_reply = nullptr;
+    pc->raw_reply = nullptr;
+    pc->abandoned = !answered;
+    if (answered) {
+        pc->next_free = mfree_pending;
+        mfree_pending = pc->index;
+    }
+}
 
-    json_object* j_obj;
+/* hands a reply to user code, on the executor when there is one */
+void WsClientAudio4a::reply_to(const reply_fun& f, int status, struct json_object* reply) {
+    if (mexecutor) {
+        if (!f && onReply == nullptr) return;
+        if (reply) json_object_get(reply);
+        mexecutor([this, f, status, reply]() {
+            if (f) {
+                f(status, reply);
+            } else if (onReply != nullptr) {
+                onReply(reply);
+            }
+            if (reply) json_object_put(reply);
+        });
+        return;
+    }
+    if (f) {
+        f(status, reply);
+    } else if (onReply != nullptr) {
+        onReply(reply);
+    }
+}
 
-    int err = wrap_json_pack(&j_obj, "{s:s,s:s}", "audio_role", audioRole.c_str(), "endpoint_type", endPointString.c_str(), "endpoint_id", endpointID);
-    if (err) return -1;
+/* the text stays in the message, which the executor keeps until the handler returned */
+void WsClientAudio4a::raw_reply_to(const raw_reply_fun& f, int status, struct afb_wsj1_msg* msg) {
+    const char* text = msg ? afb_wsj1_msg_object_s(msg) : NULL;
+    string_view reply = text ? string_view(text) : string_view();
+    if (mexecutor) {
+        if (msg) afb_wsj1_msg_addref(msg);
+        mexecutor([f, status, reply, msg]() {
+            f(status, reply);
+            if (msg) afb_wsj1_msg_unref(msg);
+        });
+        return;
+    }
+    f(status, reply);
+}
 
-    return this->call(__FUNCTION__, j_obj);
+/* reply handlers given to submit() run on the I/O thread, user ones go through reply_to() */
+WsClientAudio4a::reply_fun WsClientAudio4a::user_reply(reply_fun&& f) {
+    if (!mexecutor || !f) return std::move(f);
+    return [this, f](int status, json_object* reply) { reply_to(f, status, reply); };
+}
+
+WsClientAudio4a::batch_fun WsClientAudio4a::user_batch(batch_fun&& f) {
+    if (!mexecutor || !f) return std::move(f);
+    return [this, f](const vector<BatchItemResult>& results) {
+        mexecutor([f, results]() { f(results); });
+    };
+}
+
+/* records the stream once stream_open succeeded, then hands the reply over */
+WsClientAudio4a::reply_fun WsClientAudio4a::track_open(TrackedStream&& info, reply_fun&& on_reply) {
+    return [this, info, on_reply](int status, json_object* reply) {
+        int id = (status == Reply_Ok) ? reply_stream_id(reply) : -1;
+        if (id >= 0) {
+            TrackedStream& t = mstreams[id];
+            t = info;
+            /* what the service has for a stream just opened, a reopened one included:
+               the state it is restored to must not be taken as already applied */
+            t.state = AHL_STREAM_STATE_IDLE;
+            t.mute = false;
+            t.state_calls = 0;
+        }
+        reply_to(on_reply, status, reply);
+    };
+}
+
+/* keeps the last acknowledged state/mute of a tracked stream */
+void WsClientAudio4a::apply_state(int streamID, int status, const string& state, bool mute) {
+    auto it = mstreams.find(streamID);
+    if (it != mstreams.end() && it->second.state_calls > 0) {
+        it->second.state_calls--;
+    }
+    if (status == Reply_Ok && it != mstreams.end()) {
+        it->second.state = state;
+        it->second.mute = mute;
+    }
+    if (status == Reply_Ok && !mqueries.empty()) {
+        invalidate_queries(Query_StreamInfo, "", streamID);
+    }
+}
 
+/* answered is false on timeout and cancel, the reply may still come for that slot */
+void WsClientAudio4a::complete_pending(PendingCall* pc, int status, struct json_object* reply, bool answered) {
+    VerbCounters& vs = mverb_stats[pc->verb];
+    vs.latency.record(now_ns() - pc->sent_ns);
+    vs.in_flight.fetch_sub(1, memory_order_relaxed);
+    if (status != Reply_Ok) {
+        vs.errors.fetch_add(1, memory_order_relaxed);
+    }
+    for (RequestHandle ticket : pc->tickets) {
+        mtickets.erase(ticket);
+    }
+    pc->tickets.clear();
+    if (pc->track_stream >= 0) {
+        apply_state(pc->track_stream, status, pc->track_state, pc->track_mute);
+    }
+    mdeadlines.remove(pc);
+    if (pc->queued) {
+        /* never sent, afb-wsj1 does not know the slot */
+        unqueue_send(pc);
+        answered = true;
+    } else if (pc->evicted) {
+        pc->evicted = false;
+        mnevicted--;
+        answered = true;
+    }
+    mwire_bytes -= pc->wire_bytes;
+    pc->wire_bytes = 0;
+    reply_fun f = std::move(pc->on_reply);
+    raw_reply_fun rf = std::move(pc->raw_reply);
+    struct afb_wsj1_msg* msg = pc->reply_msg;
+    pc->reply_msg = NULL;
+    release_pending(pc, answered);
+    /* before the handler, so that its own calls do not overtake the queue */
+    if (msend_ready) {
+        pump_sends();
+    }
+    if (rf) {
+        raw_reply_to(rf, status, msg);
+    } else if (f) {
+        f(status, reply);
+    } else {
+        reply_to(f, status, reply);
+    }
+    if (mblocked) {
+        notify_capacity();
+    }
 }
 
 /**
- * This function calls connect of Audio Manager via WebSocket
- * connect is to get sound right
+ * Register callback function for each event
  *
  * #### Parameters
- * - audioRole [in] : Audio Role as defined within audio-4a Configuration
- * - endPointType [in] : Either AUDIO4A_ENDPOINT_SINK or AUDIO4A_ENDPOINT_SOURCE
+ * - event_name [in] : This argument should be specified to the event name
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
+ * - Returns 0 once the subscription is recorded or -1 when the client is not connected.
  *
  * #### Note
- * This function must be called to get source right
- * connectionID is returned by reply event
+ * This function enables to get an event to your callback function.
+ * Regarding the list of event name, please refer to CommandSender API and RountingSender API.
+ * Subscriptions are counted per event, only the first one reaches the service. Changes
+ * made during one loop iteration are sent together once it is over, in a single
+ * event_subscription call per direction, so components subscribing at startup cost
+ * one round trip. A batch refused by the send queue limits is sent again once there
+ * is room, see set_send_queue_limit(), after any other failure on reconnection.
  *
  */
-int WsClientAudio4a::stream_open(const string& audioRole, EndPointType4aT endPointType, const int endpointID) {
-
-    if (!sp_websock) return -1;
-
-    const char* endPointEnum;
-    switch (endPointType) {
-        case AUDIO4A_ENDPOINT_SINK:
-            endPointEnum = AHL_ENDPOINTTYPE_SINK;
-            break;
-            
-        case AUDIO4A_ENDPOINT_SOURCE:
-            endPointEnum = AHL_ENDPOINTTYPE_SOURCE;
-            break;
+int WsClientAudio4a::subscribe(const string& event_name) {
 
-        default: return -1;
+    if (!ready()) return -1;
+    if (!on_io_thread()) {
+        run_on_io([this, event_name]() { subscribe(event_name); });
+        return 0;
     }
 
-    json_object* j_obj = json_object_new_object();
-    int err = wrap_json_pack(&j_obj, "{s:s,s:s,s:i*}", "audio_role",  audioRole.c_str(), "endpoint_type", endPointEnum, "endpoint_id", endpointID);
-    if (err) return -1;
-    
-    return this->call(__FUNCTION__, j_obj);
+    intern_event(string(API) + "/" + event_name);
+    Subscription& sub = msubscriptions[event_name];
+    sub.forced_off = false;
+    if (sub.refs++ == 0 && !sub.active) {
+        schedule_subscriptions();
+    }
+    return 0;
 }
 
-
 /**
- * This function calls the disconnect of Audio Manager via WebSocket
+ * Unregister callback function for each event
  *
  * #### Parameters
- * - connectionID  [in] : This parameter is returned value of connect
+ * - event_name [in] : This argument should be specified to the event name
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
+ * - Returns 0 once the unsubscription is recorded or -1 when the client is not connected.
  *
  * #### Note
- *
+ * This function disables to get an event to your callback function.
+ * The event stays subscribed until every subscribe() was matched by an unsubscribe().
+ * Without any subscribe(), e.g. for the stream events audio-4a subscribes clients to
+ * by itself, the unsubscription is sent as is.
  *
  */
-int WsClientAudio4a::stream_close(int streamID) {
+int WsClientAudio4a::unsubscribe(const string& event_name) {
+
+    if (!ready()) return -1;
+    if (!on_io_thread()) {
+        run_on_io([this, event_name]() { unsubscribe(event_name); });
+        return 0;
+    }
 
-    if (!sp_websock) return -1;
+    Subscription& sub = msubscriptions[event_name];
+    if (sub.refs == 0) {
+        sub.forced_off = true;
+    } else if (--sub.refs > 0) {
+        return 0;
+    }
+    schedule_subscriptions();
+    return 0;
+}
 
-    json_object* j_obj = json_object_new_object();
-    int err = wrap_json_pack(&j_obj, "{i*}", streamID);
-    if (err) return -1;
-    return this->call(__FUNCTION__, j_obj);
+/* once per loop iteration, whatever the number of changes */
+void WsClientAudio4a::schedule_subscriptions() {
+    if (msubscription_flush) return;
+    if (!mploop || sd_event_add_defer(mploop, &msubscription_flush, _on_subscription_flush_static, this) < 0) {
+        msubscription_flush = NULL;
+        flush_subscriptions();
+    }
+}
+
+void WsClientAudio4a::on_subscription_flush(void) {
+    sd_event_source_unref(msubscription_flush);
+    msubscription_flush = NULL;
+    flush_subscriptions();
+}
+
+/* what the service has is brought in line with the counts, events back to 0 are forgotten */
+void WsClientAudio4a::flush_subscriptions() {
+    if (msubscription_flush) {
+        sd_event_source_unref(msubscription_flush);
+        msubscription_flush = NULL;
+    }
+    if (!sp_websock) {
+        /* sent on reconnection */
+        return;
+    }
+    vector<string_view> on, off;
+    for (auto& it : msubscriptions) {
+        const Subscription& sub = it.second;
+        if (sub.refs > 0 && !sub.active) {
+            on.push_back(it.first);
+        } else if (sub.refs == 0 && (sub.active || sub.forced_off)) {
+            off.push_back(it.first);
+        }
+    }
+    /* each batch is kept as is when refused, the other one still goes */
+    if (!on.empty()) {
+        string& text = send_buffer();
+        ahl4a_json::subscription(text, on, true);
+        if (submit_text(AUDIO4A_VERB_EVENT_SUBSCRIPTION, text, nullptr) == InvalidRequest) {
+            ELOG("Failed to subscribe %zu events", on.size());
+            msubscriptions_refused |= (mlast_failure == Reply_WouldBlock);
+        } else {
+            for (string_view name : on) {
+                msubscriptions.find(name)->second.active = true;
+            }
+        }
+    }
+    if (!off.empty()) {
+        string& text = send_buffer();
+        ahl4a_json::subscription(text, off, false);
+        if (submit_text(AUDIO4A_VERB_EVENT_SUBSCRIPTION, text, nullptr) == InvalidRequest) {
+            ELOG("Failed to unsubscribe %zu events", off.size());
+            msubscriptions_refused |= (mlast_failure == Reply_WouldBlock);
+            return;
+        }
+    }
+    for (auto it = msubscriptions.begin(); it != msubscriptions.end();) {
+        it = (it->second.refs == 0) ? msubscriptions.erase(it) : next(it);
+    }
 }
 
 /**
- * This function calls the set_stream_state of Audio Manager via WebSocket
+ * This function registers the handler of one event type
  *
  * #### Parameters
- * - sourceID  [in] : is NULL change all stream for current client, otherwise change on one stream
- * - state     [in] : idle / idle
- * - mute      [in] : true / false 
+ * - et            [in] : This parameter is EventType of audio-4a, any value but Event_Unknown
+ * - handler_func  [in] : This parameter is callback function
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
  *
  * #### Note
- * This function must be called when application get asyncSetSourceState event
- * Input handle number attached in asyncSetSourceState and error number(0 is acknowledge)
+ * Events are routed by the name after "ahl4a/", resolved to EventType_SM once per name.
+ * Events of a type without handler are not parsed unless an event callback is registered.
  */
-int WsClientAudio4a::set_stream_state(int streamID, const string& state, const bool mute) {
-    if (!sp_websock) return -1;
-    
-    json_object* j_obj = json_object_new_object();
-    int err = wrap_json_pack(&j_obj, "{s:i*, s:s, s:b*}", "stream_id", streamID, "state", state, "mute", mute);
-    if (err) return -1;
-    
-    return this->call(__FUNCTION__, j_obj);
+void WsClientAudio4a::set_event_handler(enum EventType_SM et, handler_fun f) {
+    if (et > Event_Unknown && et < Event_Max) {
+        this->handlers[et] = std::move(f);
+    }
 }
 
 /**
- * This function calls the API of Audio Manager via WebSocket
+ * This function registers a handler receiving every ahl4a event as text
  *
  * #### Parameters
- * - verb [in] : This argument should be specified to the API name (e.g. "connect")
- * - arg  [in] : This argument should be specified to the argument of API. And this argument expects JSON object
+ * - f [in] : Called with the event name and the message text, e.g. {"event":...,"data":{...},"jtype":"afb-event"}
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
  *
  * #### Note
- * To call Audio Manager's APIs, the application should set its function name, arguments to JSON format.
- *
+ * Both views borrow the afb-wsj1 message and are only valid during the call. Without
+ * set_event_handler() nor register_callback() handlers no json_object is built for events.
  */
-int WsClientAudio4a::call(const string& verb, struct json_object* arg) {
-    int ret;
-    if (!sp_websock) {
-        return -1;
-    }
-    if (!has_verb(verb)) {
-        ELOG("verb doesn't exit");
-        return -1;
-    }
-    ret = afb_wsj1_call_j(sp_websock, API, verb.c_str(), arg, _on_reply_static, this);
-    if (ret < 0) {
-        ELOG("Failed to call verb:%s", verb.c_str());
-    }
-    return ret;
+void WsClientAudio4a::set_raw_event_handler(raw_event_fun f) {
+    mraw_event_handler = std::move(f);
 }
 
 /**
- * This function calls the API of Audio Manager via WebSocket
- * This function is overload function of "call"
+ * This function registers a typed handler for AHL_STREAM_STATE_EVENT
  *
  * #### Parameters
- * - verb [in] : This argument should be specified to the API name (e.g. "connect")
- * - arg  [in] : This argument should be specified to the argument of API. And this argument expects JSON object
+ * - f [in] : Called with stream_id, state and mute of each stream state event
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
  *
  * #### Note
- * To call Audio Manager's APIs, the application should set its function name, arguments to JSON format.
- *
+ * Typed events are decoded on demand from the raw message text: only the fields
+ * of the struct are read and no json_object is built. Strings in the struct
+ * borrow the message and are only valid during the call.
+ * set_event_handler(Event_StreamState, ...) still receives the json_object when set.
  */
-int WsClientAudio4a::call(const char* verb, struct json_object* arg) {
-    int ret;
-    if (!sp_websock) {
-        return -1;
-    }
-    if (!has_verb(string(verb))) {
-        ELOG("verb doesn't exit");
-        return -1;
-    }
-    ret = afb_wsj1_call_j(sp_websock, API, verb, arg, _on_reply_static, this);
-    if (ret < 0) {
-        ELOG("Failed to call verb:%s", verb);
-    }
-    return ret;
+void WsClientAudio4a::set_stream_state_handler(stream_state_fun f) {
+    mstream_state_handler = std::move(f);
 }
 
 /**
- * Register callback function for each event
+ * This function registers a typed handler for AHL_ENDPOINT_VOLUME_EVENT, see set_stream_state_handler
+ */
+void WsClientAudio4a::set_endpoint_volume_handler(endpoint_volume_fun f) {
+    mendpoint_volume_handler = std::move(f);
+}
+
+/**
+ * This function registers a typed handler for AHL_ENDPOINT_PROPERTY_EVENT, see set_stream_state_handler
+ */
+void WsClientAudio4a::set_endpoint_property_handler(endpoint_property_fun f) {
+    mendpoint_property_handler = std::move(f);
+}
+
+/**
+ * This function registers a typed handler for AHL_POST_ACTION_EVENT, see set_stream_state_handler
+ */
+void WsClientAudio4a::set_post_action_handler(post_action_fun f) {
+    mpost_action_handler = std::move(f);
+}
+
+/**
+ * This function adds a listener of AHL_STREAM_STATE_EVENT
  *
  * #### Parameters
- * - event_name [in] : This argument should be specified to the event name
+ * - f        [in] : Called with each event of the stream, may capture any state
+ * - streamID [in] : Stream to listen to, AnyId for all streams
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
+ * - Returns the listener ID to give to remove_listener(), InvalidListener when f is empty
  *
  * #### Note
- * This function enables to get an event to your callback function.
- * Regarding the list of event name, please refer to CommandSender API and RountingSender API.
- *
+ * Listeners are indexed by stream ID, an event only reaches the listeners of its
+ * stream and the AnyId ones, however many components listen. Events are decoded as
+ * for set_stream_state_handler(), which is called first when set. Listeners are added
+ * and removed from the thread running callbacks, listeners may do so themselves;
+ * the event still has to be subscribed to with subscribe() when needed.
  */
-int WsClientAudio4a::subscribe(const string& event_name) {
+WsClientAudio4a::ListenerId WsClientAudio4a::add_stream_state_listener(stream_state_fun f, int streamID) {
+    if (!f) return InvalidListener;
+    ListenerId id = ++mnext_listener;
+    mstream_state_listeners.add(id, streamID, std::move(f));
+    return id;
+}
 
-    if (!sp_websock) return -1;
+/**
+ * This function adds a listener of AHL_ENDPOINT_VOLUME_EVENT, indexed by endpoint ID, see add_stream_state_listener
+ */
+WsClientAudio4a::ListenerId WsClientAudio4a::add_endpoint_volume_listener(endpoint_volume_fun f, int endpointID) {
+    if (!f) return InvalidListener;
+    ListenerId id = ++mnext_listener;
+    mendpoint_volume_listeners.add(id, endpointID, std::move(f));
+    return id;
+}
 
-    json_object* j_obj = json_object_new_object();
-    int err = wrap_json_pack(&j_obj, "{[s],s:i}", event_name, "subscribe", 1);
-    if (err) return -1;
+/**
+ * This function adds a listener of AHL_ENDPOINT_PROPERTY_EVENT, indexed by endpoint ID, see add_stream_state_listener
+ */
+WsClientAudio4a::ListenerId WsClientAudio4a::add_endpoint_property_listener(endpoint_property_fun f, int endpointID) {
+    if (!f) return InvalidListener;
+    ListenerId id = ++mnext_listener;
+    mendpoint_property_listeners.add(id, endpointID, std::move(f));
+    return id;
+}
 
-    return this->call("event_subscription", j_obj);
+/**
+ * This function adds a listener of AHL_POST_ACTION_EVENT, see add_stream_state_listener
+ */
+WsClientAudio4a::ListenerId WsClientAudio4a::add_post_action_listener(post_action_fun f) {
+    if (!f) return InvalidListener;
+    ListenerId id = ++mnext_listener;
+    mpost_action_listeners.add(id, AnyId, std::move(f));
+    return id;
 }
 
 /**
- * Unregister callback function for each event
+ * This function removes a listener
  *
  * #### Parameters
- * - event_name [in] : This argument should be specified to the event name
+ * - id [in] : ID returned by one of the add_*_listener functions
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
+ * - Returns false when no such listener is registered
  *
  * #### Note
- * This function disables to get an event to your callback function.
- *
+ * A listener removed while an event is dispatched is not called anymore, its
+ * function is destroyed once the dispatch is over.
  */
-int WsClientAudio4a::unsubscribe(const string& event_name) {
-
-    if (!sp_websock) return -1;
-
-    json_object* j_obj = json_object_new_object();
-    int err = wrap_json_pack(&j_obj, "{[s],s:i}", event_name, "subscribe", 0);
-    if (err) return -1;
-
-    return this->call("event_subscription", j_obj);
+bool WsClientAudio4a::remove_listener(ListenerId id) {
+    return mstream_state_listeners.remove(id) || mendpoint_volume_listeners.remove(id) ||
+           mendpoint_property_listeners.remove(id) || mpost_action_listeners.remove(id);
 }
 
 /**
- * This function calls the set_stream_state of Audio Manager via WebSocket
+ * This function maps an event name to its EventType_SM
  *
  * #### Parameters
- * - EventType_AsyncSetSourceState     [in] : This parameter is EventType of soundmanager
- * - handler_func  [in] : This parameter is callback function
+ * - event_name [in] : Event name with or without the "ahl4a/" prefix (e.g. AHL_STREAM_STATE_EVENT)
  *
  * #### Return
- * - Returns 0 on success or -1 in case of transmission error.
+ * - Returns the event type or Event_Unknown
  *
- * #### Note
- * This function must be called when application get asyncSetSourceState event
- * Input handle number attached in asyncSetSourceState and error number(0 is acknowledge)
  */
-void WsClientAudio4a::set_event_handler(enum EventType_SM et, handler_fun f) {
-    if (et > 1 && et < NumItems) {
-        this->handlers[et] = std::move(f);
+WsClientAudio4a::EventType_SM WsClientAudio4a::event_type(string_view event_name) {
+    static const unordered_map<string_view, EventType_SM> index = [] {
+        unordered_map<string_view, EventType_SM> m;
+        for (int i = Event_Unknown + 1; i < Event_Max; i++) {
+            m.emplace(event_names[i], (EventType_SM)i);
+        }
+        return m;
+    }();
+    size_t slash = event_name.rfind('/');
+    if (slash != string_view::npos) {
+        event_name.remove_prefix(slash + 1);
+    }
+    auto i = index.find(event_name);
+    return (i != index.end()) ? i->second : Event_Unknown;
+}
+
+/* full event name to type, resolved once per name then a single hash lookup */
+WsClientAudio4a::EventType_SM WsClientAudio4a::intern_event(string_view event) {
+    auto i = mevent_ids.find(event);
+    if (i != mevent_ids.end()) {
+        return i->second;
     }
+    EventType_SM et = event_type(event);
+    mevent_names.emplace_back(event);
+    mevent_ids.emplace(string_view(mevent_names.back()), et);
+    return et;
 }
 
 /************* Callback Function *************/
 
 void WsClientAudio4a::on_hangup(void *closure, struct afb_wsj1 *wsj) {
     DLOG("%s called", __FUNCTION__);
+    /* released later, not from within its own callback */
+    if (sp_websock == wsj) {
+        if (mstale_websock) {
+            afb_wsj1_unref(mstale_websock);
+        }
+        mstale_websock = sp_websock;
+        sp_websock = NULL;
+        mconnected.store(false, memory_order_relaxed);
+    }
+    /* calls still pending will never get their reply, queued ones are not sent anymore */
+    for (size_t i = 0; i < mpending.size(); i++) {
+        if (mpending[i].in_use) {
+            complete_pending(&mpending[i], Reply_Hangup, NULL);
+        } else if (mpending[i].abandoned) {
+            release_pending(&mpending[i]);
+        }
+    }
+    for (auto& it : msubscriptions) {
+        it.second.active = false;
+    }
+    /* the service may come back with other endpoints */
+    clear_queries();
     if (onHangup != nullptr) {
-        onHangup();
+        if (mexecutor) {
+            mexecutor([this]() { onHangup(); });
+        } else {
+            onHangup();
+        }
+    }
+    /* a socket given to init_fd() cannot be connected again */
+    if (mreconnect && !muri.empty()) {
+        schedule_reconnect();
     }
 }
 
@@ -499,88 +3106,107 @@ void WsClientAudio4a::on_call(void *closure, const char *api, const char *verb,
  */
 void WsClientAudio4a::on_event(void *closure, const char *event, struct afb_wsj1_msg *msg) {
     /* check event is for us */
-    string ev = string(event);
-    if (ev.find(API) == string::npos) {
+    string_view ev(event);
+    if (ev.find(API) == string_view::npos) {
         /* It's not us */
         return;
     }
+    EventType_SM et = intern_event(ev);
+    const char* text = afb_wsj1_msg_object_s(msg);
+    mevent_counts[et].fetch_add(1, memory_order_relaxed);
+    mbytes_received.fetch_add(text ? strlen(text) : 0, memory_order_relaxed);
+    if (et == Event_StreamState) {
+        mirror_stream_event(msg);
+    } else if ((et == Event_EndpointVolume || et == Event_EndpointProperty) && !mqueries.empty()) {
+        invalidate_endpoint_event(et, msg);
+    }
+    if (mexecutor) {
+        /* the message, and the views decoded from it, live until the executor is done */
+        afb_wsj1_msg_addref(msg);
+        mexecutor([this, et, name = string(ev), msg]() {
+            deliver_event(et, name, msg);
+            afb_wsj1_msg_unref(msg);
+        });
+        return;
+    }
+    deliver_event(et, ev, msg);
+}
+
+void WsClientAudio4a::deliver_event(EventType_SM et, string_view ev, struct afb_wsj1_msg* msg) {
+    dispatch_typed_event(et, msg);
+    if (mraw_event_handler) {
+        const char* text = afb_wsj1_msg_object_s(msg);
+        mraw_event_handler(ev, text ? string_view(text) : string_view());
+    }
+    if (onEvent == nullptr && !handlers[et]) {
+        /* nobody listens, do not even parse it */
+        return;
+    }
     struct json_object* ev_contents = afb_wsj1_msg_object_j(msg);
     if ((onEvent != nullptr)) {
-        onEvent(ev, ev_contents);
-    } else {
+        onEvent(string(ev), ev_contents);
     }
 
-    dispatch_event(ev, ev_contents);
+    dispatch_event(et, ev_contents);
 
     json_object_put(ev_contents);
 }
 
 void WsClientAudio4a::on_reply(void *closure, struct afb_wsj1_msg *msg) {
-    struct json_object* reply = afb_wsj1_msg_object_j(msg);
-    /*struct json_object *json_data = json_object_object_get(reply, "response");
-    struct json_object *jverb = json_object_object_get(json_data, "verb");
-    const char* cverb = json_object_get_string(jverb);
-    DLOG("cverb is %s",cverb);
-    string verb = string(cverb);
-    DLOG("verb is %s",verb.c_str());
-
-    if(verb == "registerSource"){
-            struct json_object *jsourceID = json_object_object_get(json_data, "sourceID");
-            int sourceID = json_object_get_int(jsourceID);
-            msourceIDs.push_back(sourceID);
-            DLOG("my sourceID is created: %d", sourceID);
-    }*/
-    if (onReply != nullptr) {
-        onReply(reply);
+    PendingCall* pc = static_cast<PendingCall*> (closure);
+    const char* text = afb_wsj1_msg_object_s(msg);
+    mbytes_received.fetch_add(text ? strlen(text) : 0, memory_order_relaxed);
+    if (pc->abandoned) {
+        /* timed out or cancelled, the caller already got its answer */
+        release_pending(pc);
+        return;
     }
-    json_object_put(reply);
+    struct json_object* reply = pc->parse_reply ? afb_wsj1_msg_object_j(msg) : NULL;
+    int status = afb_wsj1_msg_is_reply_ok(msg) ? Reply_Ok : Reply_Error;
+    pc->reply_msg = msg;
+    complete_pending(pc, status, reply);
+    if (reply) json_object_put(reply);
 }
 
-int WsClientAudio4a::dispatch_event(const string &event, json_object* event_contents) {
+int WsClientAudio4a::dispatch_event(EventType_SM et, json_object* event_contents) {
     //dipatch event
-    EventType_SM x;
-
-    if (event.find(event_list[0].c_str())) {
-        x = Event_AsyncSetSourceState;
-    } else {
-        return -1;
-    }
-    auto i = this->handlers.find(x);
-    if (i != handlers.end()) {
-        i->second(event_contents);
-        return 0;
-    } else {
+    if (!handlers[et]) {
         return -1;
     }
+    handlers[et](event_contents);
+    return 0;
 }
 
-/* Internal Function in libsoundmanager */
-
-static void _ELOG(const char* func, const int line, const char* log, ...) {
-    char *message;
-    va_list args;
-    va_start(args, log);
-    if (log == NULL || vasprintf(&message, log, args) < 0)
-        message = NULL;
-    cout << "[ERROR: soundmanager]" << func << "(" << line << "):" << message << endl;
-    va_end(args);
-    free(message);
-}
-
-static void _DLOG(const char* func, const int line, const char* log, ...) {
-    char *message;
-    va_list args;
-    va_start(args, log);
-    if (log == NULL || vasprintf(&message, log, args) < 0)
-        message = NULL;
-    cout << "[DEBUG: soundmanager]" << func << "(" << line << "):" << message << endl;
-    va_end(args);
-    free(message);
+/* decoded once for the handler and the listeners of the event key, key is NULL for keyless events */
+template <typename EventT>
+static bool decode_and_call(struct afb_wsj1_msg* msg, const function<void(const EventT&)>& f,
+                            ListenerIndex<EventT>& listeners, int EventT::* key) {
+    if (!f && listeners.empty()) {
+        return false;
+    }
+    EventT ev;
+    const char* text = afb_wsj1_msg_object_s(msg);
+    if (!text || !decode_event(string_view(text), &ev)) {
+        return false;
+    }
+    if (f) {
+        f(ev);
+    }
+    listeners.dispatch(key ? ev.*key : ListenerIndex<EventT>::AnyKey, ev);
+    return true;
 }
 
-static bool has_verb(const string& verb) {
-    if (find(api_list.begin(), api_list.end(), verb) != api_list.end())
-        return true;
-    else
-        return false;
+bool WsClientAudio4a::dispatch_typed_event(EventType_SM et, struct afb_wsj1_msg* msg) {
+    switch (et) {
+        case Event_StreamState:
+            return decode_and_call<StreamStateEvent>(msg, mstream_state_handler, mstream_state_listeners, &StreamStateEvent::stream_id);
+        case Event_EndpointVolume:
+            return decode_and_call<EndpointVolumeEvent>(msg, mendpoint_volume_handler, mendpoint_volume_listeners, &EndpointVolumeEvent::endpoint_id);
+        case Event_EndpointProperty:
+            return decode_and_call<EndpointPropertyEvent>(msg, mendpoint_property_handler, mendpoint_property_listeners, &EndpointPropertyEvent::endpoint_id);
+        case Event_PostAction:
+            return decode_and_call<PostActionEvent>(msg, mpost_action_handler, mpost_action_listeners, nullptr);
+        default:
+            return false;
+    }
 }
@@ -16,12 +16,29 @@
 
 #ifndef LIBSOUNDMANAGER_H
 #define LIBSOUNDMANAGER_H
+#include <stdint.h>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <string>
+#include <string_view>
 #include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <json-c/json.h>
 #include <systemd/sd-event.h>
+#include "ahl4a-verbs.hpp"
+#include "ahl4a-events.hpp"
+#include "ahl4a-stats.hpp"
+#include "ahl4a-mpsc.hpp"
+#include "ahl4a-timer-wheel.hpp"
+#include "ahl4a-listeners.hpp"
 extern "C"
 {
 #include <afb/afb-wsj1.h>
@@ -42,12 +59,183 @@ public:
     WsClientAudio4a(const WsClientAudio4a &) = delete;
     WsClientAudio4a &operator=(const WsClientAudio4a &) = delete;
     int init(int port, const std::string& token);
+    int init(const std::string& uri);
+    int init_fd(int fd, const std::string& token);
 
     using handler_fun = std::function<void(struct json_object*)>;
 
+    /* Runs user callbacks off the I/O thread, see init_threaded() */
+    using executor_fun = std::function<void(std::function<void()> fn)>;
+    int init_threaded(int port, const std::string& token, executor_fun executor = nullptr);
+    int init_threaded(const std::string& uri, executor_fun executor = nullptr);
+    void run_on_io(std::function<void()> fn);
+
+    /* Driving the client from a foreign event loop (Qt, GLib, asio...) */
+    int get_fd() const;
+    int get_timeout();
+    int process();
+
+    /* Per-call completion: status is one of ReplyStatus, reply is only valid during the call */
+    typedef uint64_t RequestHandle;
+    static const RequestHandle InvalidRequest = 0;
+    enum ReplyStatus {
+       Reply_Ok = 0,
+       Reply_Error = -1,
+       Reply_Hangup = -2,
+       Reply_Timeout = -3,     /* deadline passed, see set_timeout() */
+       Reply_Cancelled = -4,   /* see cancel() */
+       Reply_WouldBlock = -5   /* over the send limits, see set_send_queue_limit() */
+    };
+    using reply_fun = std::function<void(int status, struct json_object* reply)>;
+
+    /* AHL_PROPERTY_* of ahl-interface.h, for property() */
+    enum StandardProperty {
+       Property_Balance = 0,
+       Property_Fade,
+       Property_EqLow,
+       Property_EqMid,
+       Property_EqHigh,
+       Property_Max
+    };
+
+    /* Message text as received, borrowed and only valid during the call, no json_object is built */
+    using raw_reply_fun = std::function<void(int status, std::string_view reply)>;
+    using raw_event_fun = std::function<void(std::string_view event, std::string_view message)>;
+
+    /* Batched stream operations, see stream_open_batch() */
+    struct StreamOpenRequest {
+        std::string audio_role;
+        EndPointType4aT endpoint_type;
+        int endpoint_id;
+    };
+    struct StreamStateRequest {
+        int stream_id;
+        std::string state;
+        bool mute;
+    };
+    struct BatchItemResult {
+        int status;     /* ReplyStatus of this item */
+        int stream_id;  /* stream returned by stream_open or the stream acted on, -1 if unknown */
+    };
+    using batch_fun = std::function<void(const std::vector<BatchItemResult>& results)>;
+
+    /* Send scheduling by audio role (AHL_ROLE_*), see set_send_window() */
+    static const int RoleCount = 9;
+    static const int PriorityLevels = 8;
+    using capacity_fun = std::function<void()>;
+
+    /* Internal only: one slot per in-flight call, the slot address is the afb-wsj1 reply closure */
+    struct PendingCall {
+        WsClientAudio4a* owner = nullptr;
+        uint32_t index = 0;
+        uint32_t generation = 0;
+        uint32_t next_free = 0;     /* next free slot, set by acquire_pending() and release_pending() */
+        bool in_use = false;
+        Audio4aVerbT verb = AUDIO4A_VERB_UNKNOWN;
+        uint64_t sent_ns = 0;
+        std::vector<RequestHandle> tickets; /* handles given to other threads, see init_threaded() */
+        reply_fun on_reply;
+        bool parse_reply = true;    /* false: on_reply gets a NULL reply, see set_allocation_free() */
+        int track_stream = -1;      /* stream whose state and mute apply once acknowledged */
+        bool track_mute = false;
+        std::string track_state;
+        bool abandoned = false;     /* answered by timeout or cancel, still waiting for afb-wsj1 */
+        PendingCall* timer_prev = nullptr;  /* deadline, see TimerWheel */
+        PendingCall* timer_next = nullptr;
+        uint64_t timer_due = 0;
+        int timer_slot = -1;
+        int role = 0;               /* index of the audio role, sets the send priority */
+        int priority = 0;
+        bool queued = false;        /* waiting for the send window, request in queued_text */
+        std::string queued_text;
+        size_t wire_bytes = 0;      /* request size while on the wire */
+        PendingCall* send_prev = nullptr;
+        PendingCall* send_next = nullptr;
+        raw_reply_fun raw_reply;    /* instead of on_reply, see call_raw() */
+        struct afb_wsj1_msg* reply_msg = nullptr;   /* reply being completed */
+        bool evicted = false;       /* dropped from the send queue, completed by on_evicted() */
+    };
+
     enum EventType_SM {
-       Event_AsyncSetSourceState = 1    /*arg key: {sourceID, handle, sourceState}*/
+       Event_Unknown = 0,
+       Event_AsyncSetSourceState = 1,   /*arg key: {sourceID, handle, sourceState}*/
+       Event_NewMainConnection,
+       Event_VolumeChanged,
+       Event_RemovedMainConnection,
+       Event_SinkMuteStateChanged,
+       Event_MainConnectionStateChanged,
+       Event_SetRoutingReady,
+       Event_SetRoutingRundown,
+       Event_AsyncConnect,
+       Event_EndpointProperty,          /* AHL_ENDPOINT_PROPERTY_EVENT */
+       Event_EndpointVolume,            /* AHL_ENDPOINT_VOLUME_EVENT */
+       Event_PostAction,                /* AHL_POST_ACTION_EVENT */
+       Event_StreamState,               /* AHL_STREAM_STATE_EVENT */
+       Event_Max
+    };
+    static EventType_SM event_type(std::string_view event_name);
+
+    /* Typed events, decoded from the message text without building a json-c tree */
+    using stream_state_fun = std::function<void(const StreamStateEvent&)>;
+    using endpoint_volume_fun = std::function<void(const EndpointVolumeEvent&)>;
+    using endpoint_property_fun = std::function<void(const EndpointPropertyEvent&)>;
+    using post_action_fun = std::function<void(const PostActionEvent&)>;
+
+    /* Any number of typed event listeners, see add_stream_state_listener() */
+    typedef uint64_t ListenerId;
+    static const ListenerId InvalidListener = 0;
+    static const int AnyId = -1;
+
+    /* Histograms copied by get_stats(), 608 buckets each */
+    enum StatsPart {
+        Stats_Counters = 0,
+        Stats_Latency = 1 << 0,     /* Stats::Verb::latency */
+        Stats_Wait = 1 << 1,        /* Stats::Role::wait */
+        Stats_All = Stats_Latency | Stats_Wait
+    };
+
+    /* Client statistics snapshot, see get_stats() */
+    struct Stats {
+        struct Verb {
+            uint64_t calls;
+            uint64_t errors;
+            uint64_t in_flight;
+            LatencyHistogram::Snapshot latency;
+        };
+        struct Role {
+            const char* name;
+            int priority;
+            uint64_t queued;        /* waiting for the send window now */
+            uint64_t max_queued;
+            LatencyHistogram::Snapshot wait;    /* time spent queued by the calls sent */
+        };
+        Verb verbs[AUDIO4A_VERB_COUNT];
+        Role roles[RoleCount];
+        uint64_t events[Event_Max];
+        uint64_t bytes_sent;
+        uint64_t bytes_received;
+        uint64_t would_block;   /* calls refused or evicted with Reply_WouldBlock */
+        unsigned parts;         /* StatsPart histograms filled in */
+
+        struct json_object* to_json() const;
+    };
+
+    /* Local mirror of the streams opened by this client, see get_stream() */
+    struct StreamInfo {
+        int stream_id;
+        std::string audio_role;
+        std::string endpoint_type;
+        int endpoint_id;
+        std::string state;      /* AHL_STREAM_STATE_* */
+        bool mute;
+    };
+
+    /* Reconnection, see enable_reconnect() */
+    struct StreamRemap {
+        int old_stream_id;
+        int new_stream_id;  /* -1 when the stream could not be reopened */
     };
+    using reconnect_fun = std::function<void(const std::vector<StreamRemap>& streams)>;
 
     /* Method */
     int registerSource(const std::string& sourceName);
@@ -58,11 +246,70 @@ public:
 
     int set_stream_state(int streamID, const std::string& state, const bool mute);
 
-    int call(const std::string& verb, struct json_object* arg);
-    int call(const char* verb, struct json_object* arg);
+    RequestHandle stream_open(const std::string& audioRole, EndPointType4aT endPointType, const int endpointID, reply_fun on_reply);
+    RequestHandle stream_close(int streamID, reply_fun on_reply);
+    RequestHandle set_stream_state(int streamID, const std::string& state, const bool mute, reply_fun on_reply);
+
+    int stream_open_batch(const std::vector<StreamOpenRequest>& requests, batch_fun on_done);
+    int stream_close_batch(const std::vector<int>& streamIDs, batch_fun on_done);
+    int set_stream_state_batch(const std::vector<StreamStateRequest>& requests, batch_fun on_done);
+
+    int call(std::string_view verb, struct json_object* arg);
+    int call(Audio4aVerbT verb, struct json_object* arg);
+    RequestHandle call(std::string_view verb, struct json_object* arg, reply_fun on_reply);
+    RequestHandle call(Audio4aVerbT verb, struct json_object* arg, reply_fun on_reply);
+    RequestHandle call_raw(std::string_view verb, std::string_view args, raw_reply_fun on_reply);
+    RequestHandle call_raw(Audio4aVerbT verb, std::string_view args, raw_reply_fun on_reply);
+    bool is_pending(RequestHandle handle) const;
+    size_t pending_calls() const;
+
+    /* Send window, queued calls go out by role priority */
+    void set_send_window(size_t max_in_flight, size_t max_in_flight_bytes = 0);
+    void set_send_queue_limit(size_t max_calls, size_t max_bytes = SIZE_MAX);
+    void set_capacity_handler(capacity_fun f);
+    int set_role_priority(const std::string& role, int priority);
+
+    /* Deadlines and cancellation, the completion handler gets Reply_Timeout or Reply_Cancelled */
+    void set_default_timeout(uint64_t timeout_us);
+    int set_timeout(RequestHandle handle, uint64_t timeout_us);
+    int cancel(RequestHandle handle);
+    void get_stats(Stats* stats, bool reset = false, unsigned parts = Stats_All);
+
+    bool get_stream(int streamID, StreamInfo* info) const;
+    std::vector<StreamInfo> get_streams() const;
+    void suppress_redundant_state(bool enable);
+
+    /* Cached queries, the reply is the one of the call that filled the cache, see set_query_cache() */
+    RequestHandle get_endpoints(const std::string& audioRole, EndPointType4aT endPointType, reply_fun on_reply);
+    RequestHandle get_endpoint_info(int endpointID, EndPointType4aT endPointType, reply_fun on_reply);
+    RequestHandle get_stream_info(int streamID, reply_fun on_reply);
+    void set_query_cache(bool enable, uint64_t ttl_us = 0);
+
+    /* Endpoint settings, coalesced per endpoint and property when enabled, see set_coalescing() */
+    RequestHandle volume(EndPointType4aT endPointType, int endpointID, int volume, reply_fun on_reply);
+    RequestHandle property(EndPointType4aT endPointType, int endpointID, const std::string& propertyName, double value, reply_fun on_reply);
+    RequestHandle property(EndPointType4aT endPointType, int endpointID, StandardProperty property, double value, reply_fun on_reply);
+    void set_coalescing(bool enable, uint64_t window_us = 0);
+
+    /* Steady state without heap allocation, to be set before init() */
+    void set_allocation_free(bool enable, size_t max_in_flight = 64, size_t max_streams = 16);
+
+    void enable_reconnect(bool enable, uint64_t min_backoff_us = 10000, uint64_t max_backoff_us = 1000000);
+    void set_reconnect_handler(reconnect_fun f);
+    bool is_connected() const;
     int subscribe(const std::string& event_name);
     int unsubscribe(const std::string& event_name);
     void set_event_handler(enum EventType_SM et, handler_fun f);
+    void set_raw_event_handler(raw_event_fun f);
+    void set_stream_state_handler(stream_state_fun f);
+    void set_endpoint_volume_handler(endpoint_volume_fun f);
+    void set_endpoint_property_handler(endpoint_property_fun f);
+    void set_post_action_handler(post_action_fun f);
+    ListenerId add_stream_state_listener(stream_state_fun f, int streamID = AnyId);
+    ListenerId add_endpoint_volume_listener(endpoint_volume_fun f, int endpointID = AnyId);
+    ListenerId add_endpoint_property_listener(endpoint_property_fun f, int endpointID = AnyId);
+    ListenerId add_post_action_listener(post_action_fun f);
+    bool remove_listener(ListenerId id);
     
     void register_callback(
         void (*event_cb)(const std::string& event, struct json_object* event_contents),
@@ -74,21 +321,263 @@ public:
 
 private:
     int init_event();
-    int initialize_websocket();
-    int dispatch_event(const std::string& event, struct json_object* ev_contents);
+    int init_loop();
+    int initialize_websocket(bool own_loop = false);
+    int connect_websocket(int upgrade_timeout_ms);
+    void schedule_reconnect();
+    void restore_session();
+    void schedule_subscriptions();
+    void flush_subscriptions();
+    void notify_reconnect(const std::vector<StreamRemap>& streams);
+    EventType_SM intern_event(std::string_view event);
+    int dispatch_event(EventType_SM et, struct json_object* ev_contents);
+    bool dispatch_typed_event(EventType_SM et, struct afb_wsj1_msg* msg);
+    void deliver_event(EventType_SM et, std::string_view event, struct afb_wsj1_msg* msg);
+
+    RequestHandle submit(Audio4aVerbT verb, struct json_object* arg, reply_fun&& on_reply);
+    RequestHandle submit_text(Audio4aVerbT verb, const std::string& text, reply_fun&& on_reply, int role = -1);
+    RequestHandle send(Audio4aVerbT verb, const char* text, size_t len, reply_fun&& on_reply, int role);
+    int transmit(PendingCall* pc, const char* text, size_t len);
+    void queue_send(PendingCall* pc, const char* text, size_t len);
+    void unqueue_send(PendingCall* pc);
+    void pump_sends();
+    void evict(PendingCall* pc);
+    bool wire_room(size_t len) const;
+    bool queue_room(size_t len) const;
+    void notify_capacity();
+    int submit_batch(Audio4aVerbT verb, std::vector<std::string>& args, std::vector<int>&& roles,
+                     std::vector<BatchItemResult>&& results, batch_fun&& on_done);
+    PendingCall* acquire_pending(RequestHandle* handle);
+    void release_pending(PendingCall* pc, bool answered = true);
+    void complete_pending(PendingCall* pc, int status, struct json_object* reply, bool answered = true);
+    uint32_t pending_index(RequestHandle handle) const;
+    void arm_deadline(PendingCall* pc, uint64_t timeout_us);
+    void arm_deadline_timer();
+    void reply_to(const reply_fun& f, int status, struct json_object* reply);
+    void raw_reply_to(const raw_reply_fun& f, int status, struct afb_wsj1_msg* msg);
+    RequestHandle send_raw(Audio4aVerbT verb, std::string_view args, raw_reply_fun&& on_reply, bool report_failure);
+    reply_fun user_reply(reply_fun&& f);
+    batch_fun user_batch(batch_fun&& f);
+
+    /* I/O thread mode: any thread queues work, the I/O thread owns the loop and the websocket */
+    struct IoTask {
+        std::atomic<IoTask*> next{nullptr};
+        Audio4aVerbT verb = AUDIO4A_VERB_UNKNOWN;
+        struct json_object* arg = nullptr;
+        std::string text;               /* request when arg is NULL */
+        int role = -1;
+        reply_fun on_reply;
+        RequestHandle ticket = InvalidRequest;
+        std::function<void()> fn;       /* run instead of a call when set */
+    };
+    bool on_io_thread() const;
+    /*
+     * Result of f computed on the I/O thread, fallback once that thread is gone.
+     * The thread signals msync_cv with each answer and when it exits, a task it
+     * never ran then ends the wait as well.
+     */
+    template <class F, class R>
+    R on_io_sync(F&& f, R fallback) const {
+        struct Answer {
+            bool done = false;
+            R value;
+        };
+        if (mstopping.load(std::memory_order_acquire)) return fallback;
+        WsClientAudio4a* self = const_cast<WsClientAudio4a*>(this);
+        auto answer = std::make_shared<Answer>();
+        self->run_on_io([self, answer, f]() {
+            R value = f();
+            std::lock_guard<std::mutex> lock(self->msync_lock);
+            answer->value = value;
+            answer->done = true;
+            self->msync_cv.notify_all();
+        });
+        std::unique_lock<std::mutex> lock(msync_lock);
+        msync_cv.wait(lock, [this, &answer]() { return answer->done || mio_exited; });
+        return answer->done ? answer->value : fallback;
+    }
+    bool ready() const;
+    RequestHandle queue_call(Audio4aVerbT verb, struct json_object* arg, std::string&& text, reply_fun&& on_reply, int role);
+    RequestHandle next_ticket();
+    void bind_ticket(RequestHandle ticket, RequestHandle handle);
+    void post_task(IoTask* task);
+    void run_task(IoTask* task);
+    void wake();
+    void io_main(std::promise<int>* started);
+    void shutdown_io();
+
+    /* subscribe() count of an event, the service only hears about changes */
+    struct Subscription {
+        int refs = 0;
+        bool active = false;        /* subscribed on the service side */
+        bool forced_off = false;    /* unsubscribed without matching subscribe() */
+    };
+
+    /* streams opened through this client, replayed after reconnection */
+    struct TrackedStream {
+        std::string audio_role;
+        std::string endpoint_type;
+        int endpoint_id;
+        std::string state;
+        bool mute;
+        unsigned state_calls = 0;   /* set_stream_state in flight */
+    };
+    reply_fun track_open(TrackedStream&& info, reply_fun&& on_reply);
+    void apply_state(int streamID, int status, const std::string& state, bool mute);
+    struct json_object* unchanged_reply(int streamID);
+    void preallocate();
+    RequestHandle send_stream_state(int streamID, const std::string& state, bool mute, reply_fun&& on_reply, bool report_failure);
+    RequestHandle send_stream_close(int streamID, reply_fun&& on_reply, bool report_failure);
+    int stream_role(int streamID) const;
+    void mirror_stream_event(struct afb_wsj1_msg* msg);
+
+    /* one entry per distinct query, shared by concurrent callers */
+    enum QueryKind {
+        Query_Endpoints,
+        Query_EndpointInfo,
+        Query_StreamInfo
+    };
+    struct QueryEntry {
+        QueryKind kind;
+        std::string endpoint_type;
+        int id;                                 /* endpoint or stream, -1 for lists */
+        struct json_object* reply = nullptr;    /* cached reply, NULL when stale */
+        uint64_t fetched_us = 0;
+        uint32_t generation = 0;                /* bumped on invalidation */
+        bool in_flight = false;
+        RequestHandle handle = InvalidRequest;
+        std::vector<reply_fun> waiters;
+    };
+    RequestHandle query(std::string&& key, QueryKind kind, const char* endpoint_type, int id,
+                        Audio4aVerbT verb, struct json_object* arg, reply_fun&& on_reply, bool report_failure);
+    void complete_query(const std::string& key, uint32_t generation, int status, struct json_object* reply);
+    void invalidate_queries(QueryKind kind, std::string_view endpoint_type, int id);
+    void invalidate_endpoint_event(EventType_SM et, struct afb_wsj1_msg* msg);
+    void clear_queries();
+
+    /* latest value per endpoint setting, at most one request in flight each */
+    struct CoalesceEntry {
+        WsClientAudio4a* owner;
+        Audio4aVerbT verb;
+        std::string queued;                     /* newest request text */
+        bool has_queued = false;                /* queued was not sent yet */
+        std::vector<reply_fun> waiters;         /* callers answered by the next send */
+        bool in_flight = false;
+        uint64_t last_sent_us = 0;
+        sd_event_source* timer = nullptr;
+    };
+    RequestHandle coalesce(std::string&& key, Audio4aVerbT verb, const std::string& text, reply_fun&& on_reply, bool report_failure);
+    RequestHandle flush_coalesced(CoalesceEntry* e, bool report_last);
+    void schedule_coalesced(CoalesceEntry* e);
+
+    /* lock-free recorders behind get_stats() */
+    struct VerbCounters {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> in_flight{0};
+        LatencyHistogram latency;
+    };
+    struct RoleCounters {
+        std::atomic<uint64_t> queued{0};
+        std::atomic<uint64_t> max_queued{0};
+        LatencyHistogram wait;
+    };
 
     void (*onEvent)(const std::string& event, struct json_object* event_contents);
     void (*onReply)(struct json_object* reply);
     void (*onHangup)(void);
+    reconnect_fun onReconnect;
 
     struct afb_wsj1* sp_websock;
+    struct afb_wsj1* mstale_websock;
     struct afb_wsj1_itf minterface;
     sd_event* mploop;
     int mport;
     std::string mtoken;
+    std::string muri;
+    std::map<std::string, Subscription, std::less<>> msubscriptions;
+    sd_event_source* msubscription_flush;
+    bool msubscriptions_refused;            /* a batch hit the send queue limits, sent again by notify_capacity() */
+    std::unordered_map<int, TrackedStream> mstreams;
+    bool msuppress_redundant;
+    std::unordered_map<std::string, QueryEntry> mqueries;
+    bool mquery_cache;
+    uint64_t mquery_ttl_us;
+    bool mendpoint_events;
+    std::unordered_map<std::string, CoalesceEntry> mcoalesce;
+    bool mcoalescing;
+    uint64_t mcoalesce_window_us;
+    bool mallocation_free;
+    size_t mprealloc_calls;
+    size_t mprealloc_streams;
+    struct json_object* munchanged;     /* reused "unchanged" reply and its stream_id member */
+    struct json_object* munchanged_id;
+    bool mreconnect;
+    uint64_t mbackoff_min_us;
+    uint64_t mbackoff_max_us;
+    uint64_t mbackoff_us;
+    sd_event_source* mreconnect_timer;
+    int mfd;                            /* socket given to init_fd(), until connected */
+    std::atomic<bool> mconnected;
+    bool mthreaded;
+    std::thread mio_thread;
+    std::thread::id mio_id;
+    std::atomic<bool> mstopping;
+    mutable std::mutex msync_lock;      /* on_io_sync() answers and mio_exited */
+    mutable std::condition_variable msync_cv;
+    bool mio_exited;
+    std::atomic<bool> mwake_armed;
+    int mwake_fd;
+    sd_event_source* mwake_source;
+    MpscQueue<IoTask> mio_queue;
+    executor_fun mexecutor;
+    std::atomic<uint64_t> mnext_ticket;
+    std::unordered_map<RequestHandle, RequestHandle> mtickets;
     std::vector<int> msourceIDs;
-    std::map<EventType_SM, handler_fun> handlers;
-    EventType_SM const NumItems = (EventType_SM)(Event_AsyncSetSourceState + 1);
+    handler_fun handlers[Event_Max];
+    stream_state_fun mstream_state_handler;
+    endpoint_volume_fun mendpoint_volume_handler;
+    endpoint_property_fun mendpoint_property_handler;
+    post_action_fun mpost_action_handler;
+    ListenerIndex<StreamStateEvent> mstream_state_listeners;        /* by stream ID */
+    ListenerIndex<EndpointVolumeEvent> mendpoint_volume_listeners;  /* by endpoint ID */
+    ListenerIndex<EndpointPropertyEvent> mendpoint_property_listeners;
+    ListenerIndex<PostActionEvent> mpost_action_listeners;
+    ListenerId mnext_listener;
+    raw_event_fun mraw_event_handler;
+    std::unordered_map<std::string_view, EventType_SM> mevent_ids;
+    std::deque<std::string> mevent_names;
+    std::deque<PendingCall> mpending;
+    uint32_t mfree_pending;
+    size_t mnpending;
+    TimerWheel<PendingCall> mdeadlines;     /* millisecond ticks */
+    uint64_t mdefault_timeout_us;
+    sd_event_source* mdeadline_timer;
+    uint64_t mdeadline_armed;               /* tick the timer is set to, TimerWheel::Never when off */
+    size_t msend_window;                    /* 0: no limit */
+    size_t msend_window_bytes;
+    size_t mwire_bytes;
+    size_t mqueue_max_calls;                /* 0: fail fast once the window is full */
+    size_t mqueue_max_bytes;
+    size_t mqueued_bytes;
+    size_t mnqueued;
+    PendingCall* msend_head[PriorityLevels];
+    PendingCall* msend_tail[PriorityLevels];
+    unsigned msend_ready;                   /* bit set per non-empty priority queue */
+    bool mpumping;
+    std::vector<RequestHandle> mevicted;    /* dropped by send(), their handlers run from mevicted_flush */
+    sd_event_source* mevicted_flush;
+    size_t mnevicted;                       /* neither queued nor on the wire */
+    int mrole_priority[RoleCount];
+    std::unique_ptr<RoleCounters[]> mrole_stats;
+    int mlast_failure;                      /* ReplyStatus of the last send() refused */
+    bool mblocked;                          /* a call was refused, mcapacity_handler is due */
+    capacity_fun mcapacity_handler;
+    std::atomic<uint64_t> mwould_block;
+    std::unique_ptr<VerbCounters[]> mverb_stats;
+    std::atomic<uint64_t> mevent_counts[Event_Max];
+    std::atomic<uint64_t> mbytes_sent;
+    std::atomic<uint64_t> mbytes_received;
 
 public:
     /* Don't use/ Internal only */
@@ -96,6 +585,12 @@ public:
     void on_call(void *closure, const char *api, const char *verb, struct afb_wsj1_msg *msg);
     void on_event(void *closure, const char *event, struct afb_wsj1_msg *msg);
     void on_reply(void *closure, struct afb_wsj1_msg *msg);
+    void on_reconnect_timer(void);
+    void on_io_wake(void);
+    static void on_coalesce_timer(void* entry);
+    void on_deadline_timer(void);
+    void on_subscription_flush(void);
+    void on_evicted(void);
 };
 
 #endif /* LIBSOUNDMANAGER_H */